@@ -5,20 +5,41 @@
 struct MemoryStack 
 {
     byte *	base;
-    size_t	max_size;
+    size_t	max_size;           // NOTE: size of the reserved address range
     size_t	bytes_used;
+    size_t	bytes_committed;    // NOTE: growable stacks commit pages on demand up to max_size
+    size_t	high_water_mark;
     u32 elementCount;
+    u32 tempCount;
 };
 
+// NOTE: marker for rolling the stack back to an earlier state
+struct TemporaryMemory
+{
+    MemoryStack *stack;
+    size_t bytes_used;
+    u32 elementCount;
+};
+
+// NOTE: every trip to the OS or the CRT heap for memory, hot loops should leave this unchanged
+static u64 volatile globalAllocationCount;
+#define CountAllocation() InterlockedIncrement64((LONGLONG volatile *)&globalAllocationCount)
+
+#define DEFAULT_STACK_RESERVE GIGABYTES(1)
+#define STACK_COMMIT_GRANULARITY KILOBYTES(64)
+
 #define GetArrayElements(stack, type) ((type *)stack.base)
 #define GetAt(stack, type, index) ((type *)_GetAt_(stack, sizeof(type), index))
 #define GetLast(stack, type) ((type *)_GetLastElement_(stack, sizeof(type)))
 #define PushStruct(stack, type) ((type *)_Push_(stack, sizeof(type)))  
+#define PushStructAligned(stack, type, alignment) ((type *)_Push_(stack, sizeof(type), alignment))  
 
 #define PushSize(stack, size, type) ((type *)_Push_(stack, size))  
 #define PopStruct(stack, type) ((type *)_Pop_(stack, sizeof(type)))  
 
 #define PushArray(stack, count, type) ((type *)_Push_(stack, (count) * sizeof(type)))
+#define PushArrayAligned(stack, count, type, alignment) ((type *)_Push_(stack, (count) * sizeof(type), alignment))
+#define PushSizeAligned(stack, size, type, alignment) ((type *)_Push_(stack, size, alignment))  
 #define PopArray(stack, count, type) ((type *)_Pop_(stack, (count) * sizeof(type)))
 #define CheckMemory(cond) do { if (!(cond)) { MessageBoxA(0, "Out of memory in: " ##__FILE__, 0, 0); DebugBreak(); } } while(0)
 #define PrintMessageBox(msg) MessageBoxA(0, msg, 0, 0)
@@ -31,15 +52,56 @@ GetTopMemoryStack(MemoryStack *ms)
     return ptr;
 }
 
+static size_t
+GetAlignmentOffset(MemoryStack *ms, size_t alignment)
+{
+    size_t result = 0;
+    size_t top = (size_t)(ms->base + ms->bytes_used);
+    size_t mask = alignment - 1;
+    if(top & mask)
+    {
+        result = alignment - (top & mask);
+    }
+    
+    return result;
+}
+
+static void
+CommitMemoryStack(MemoryStack *ms, size_t bytes_needed)
+{
+    if(bytes_needed > ms->bytes_committed)
+    {
+        size_t mask = STACK_COMMIT_GRANULARITY - 1;
+        size_t new_committed = (bytes_needed + mask) & ~mask;
+        if(new_committed > ms->max_size)
+        {
+            new_committed = ms->max_size;
+        }
+        void *ptr = VirtualAlloc(ms->base + ms->bytes_committed, new_committed - ms->bytes_committed, MEM_COMMIT, PAGE_READWRITE);
+        CountAllocation();
+        CheckMemory(ptr);
+        ms->bytes_committed = new_committed;
+    }
+}
+
 // NOTE: dont use the _Push_ and _Pop_ functions directly, go through the macros
-// FIXME: pass alignment
+// NOTE: pushes with padding for alignment cannot be popped, roll back with TemporaryMemory instead
 static void *
-_Push_(MemoryStack *ms, size_t num_bytes) 
+_Push_(MemoryStack *ms, size_t num_bytes, size_t alignment = 1) 
 {
-    CheckMemory((ms->bytes_used + num_bytes) <= ms->max_size);
-    void *result = ms->base + ms->bytes_used;
-    ms->bytes_used += num_bytes;
+    assert((alignment & (alignment - 1)) == 0);
+    size_t alignment_offset = GetAlignmentOffset(ms, alignment);
+    size_t new_bytes_used = ms->bytes_used + alignment_offset + num_bytes;
+    CheckMemory(new_bytes_used <= ms->max_size);
+    CommitMemoryStack(ms, new_bytes_used);
+    
+    void *result = ms->base + ms->bytes_used + alignment_offset;
+    ms->bytes_used = new_bytes_used;
     ms->elementCount++;
+    if(ms->bytes_used > ms->high_water_mark)
+    {
+        ms->high_water_mark = ms->bytes_used;
+    }
     
     return result;
 }
@@ -61,15 +123,71 @@ InitStackMemory(size_t num_bytes)
 {
     MemoryStack result = {};
     void *ptr = VirtualAlloc(0, num_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    CountAllocation();
     
     result.base = (byte *)ptr;
     result.max_size = num_bytes;
     result.bytes_used = 0;
+    result.bytes_committed = num_bytes;
     
     CheckMemory(result.base);
     return result;
 }
 
+// NOTE: Reserves address space only, pages get committed as the stack grows.
+// The range stays contiguous so GetArrayElements and GetAt keep working.
+static MemoryStack 
+InitGrowableStackMemory(size_t reserve_bytes = DEFAULT_STACK_RESERVE) 
+{
+    MemoryStack result = {};
+    void *ptr = VirtualAlloc(0, reserve_bytes, MEM_RESERVE, PAGE_READWRITE);
+    CountAllocation();
+    
+    result.base = (byte *)ptr;
+    result.max_size = reserve_bytes;
+    result.bytes_used = 0;
+    result.bytes_committed = 0;
+    
+    CheckMemory(result.base);
+    return result;
+}
+
+static TemporaryMemory
+BeginTemporaryMemory(MemoryStack *ms)
+{
+    TemporaryMemory result;
+    result.stack = ms;
+    result.bytes_used = ms->bytes_used;
+    result.elementCount = ms->elementCount;
+    ms->tempCount++;
+    
+    return result;
+}
+
+static void
+EndTemporaryMemory(TemporaryMemory temp)
+{
+    MemoryStack *ms = temp.stack;
+    assert(ms->bytes_used >= temp.bytes_used);
+    assert(ms->tempCount > 0);
+    ms->bytes_used = temp.bytes_used;
+    ms->elementCount = temp.elementCount;
+    ms->tempCount--;
+}
+
+static bool
+IsInMemoryStack(MemoryStack *ms, void *ptr)
+{
+    bool result = ((byte *)ptr >= ms->base) && ((byte *)ptr < ms->base + ms->max_size);
+    return result;
+}
+
+static void
+PrintMemoryStackStats(const char *name, MemoryStack *ms)
+{
+    printf("%s: used %zu, peak %zu, committed %zu, reserved %zu bytes\n", name, ms->bytes_used, ms->high_water_mark, ms->bytes_committed, ms->max_size);
+}
+
 static size_t
 isMemoryStackEmpty(MemoryStack *ms)
 {
@@ -84,6 +202,7 @@ FreeMemoryStack(MemoryStack *ms)
         VirtualFree(ms->base, 0, MEM_RELEASE);
         ms->max_size = 0;
         ms->bytes_used = 0;
+        ms->bytes_committed = 0;
     }
 }
 
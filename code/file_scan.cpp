@@ -0,0 +1,500 @@
+//
+// recursive directory scanning
+//
+
+#define MAX_SCAN_PATTERNS 16
+#define MAX_SCAN_PATH 1024
+
+static const char* defaultIncludePattern = "*.png";
+
+struct FileScanOptions
+{
+    const char* includePatterns[MAX_SCAN_PATTERNS];
+    const char* excludePatterns[MAX_SCAN_PATTERNS];
+    u32 includeCount;
+    u32 excludeCount;
+    bool recursive;
+    bool sorted;        // NOTE: canonical order instead of the order the walkers happened to find the files in
+};
+
+// NOTE: Relative paths packed back to back and null terminated, offsets index into the path arena.
+struct FileList
+{
+    MemoryStack pathArena;
+    MemoryStack offsetArena;
+    u32 fileCount;
+};
+
+static const char* getFileListPath(FileList* list, u32 index)
+{
+    u32 offset = *GetAt(&list->offsetArena, u32, index);
+    const char* result = (const char *)list->pathArena.base + offset;
+    
+    return result;
+}
+
+static void appendToFileList(FileList* list, const char* path)
+{
+    u32 length = (u32)strlen(path);
+    char* dest = PushArray(&list->pathArena, length + 1, char);
+    memcpy(dest, path, length + 1);
+    *PushStruct(&list->offsetArena, u32) = (u32)(dest - (char *)list->pathArena.base);
+    list->fileCount++;
+}
+
+static FileList makeFileList()
+{
+    FileList result = {};
+    result.pathArena = InitGrowableStackMemory();
+    result.offsetArena = InitGrowableStackMemory();
+    
+    return result;
+}
+
+static void destroyFileList(FileList* list)
+{
+    FreeMemoryStack(&list->pathArena);
+    FreeMemoryStack(&list->offsetArena);
+    list->fileCount = 0;
+}
+
+static bool isPathSeparator(char c)
+{
+    return (c == '\\') || (c == '/');
+}
+
+static char toLowerAscii(char c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? (char)(c - 'A' + 'a') : c;
+}
+
+// NOTE: Case insensitive like the file system. '*' and '?' stay inside one path component, '**' crosses them.
+static bool matchGlob(const char* pattern, const char* string)
+{
+    while(*pattern)
+    {
+        if((pattern[0] == '*') && (pattern[1] == '*'))
+        {
+            pattern += 2;
+            if(isPathSeparator(*pattern))
+            {
+                // "**/" matches zero or more whole directories.
+                pattern++;
+                for(const char* s = string; ; s++)
+                {
+                    if(((s == string) || isPathSeparator(s[-1])) && matchGlob(pattern, s))
+                    {
+                        return true;
+                    }
+                    if(!*s)
+                    {
+                        return false;
+                    }
+                }
+            }
+            for(const char* s = string; ; s++)
+            {
+                if(matchGlob(pattern, s))
+                {
+                    return true;
+                }
+                if(!*s)
+                {
+                    return false;
+                }
+            }
+        }
+        else if(*pattern == '*')
+        {
+            pattern++;
+            for(const char* s = string; ; s++)
+            {
+                if(matchGlob(pattern, s))
+                {
+                    return true;
+                }
+                if(!*s || isPathSeparator(*s))
+                {
+                    return false;
+                }
+            }
+        }
+        else if(*pattern == '?')
+        {
+            if(!*string || isPathSeparator(*string))
+            {
+                return false;
+            }
+        }
+        else if(isPathSeparator(*pattern))
+        {
+            if(!isPathSeparator(*string))
+            {
+                return false;
+            }
+        }
+        else if(toLowerAscii(*pattern) != toLowerAscii(*string))
+        {
+            return false;
+        }
+        pattern++;
+        string++;
+    }
+    
+    return *string == 0;
+}
+
+static bool hasPathSeparator(const char* string)
+{
+    for(; *string; string++)
+    {
+        if(isPathSeparator(*string))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// NOTE: Patterns with a separator are matched against the relative path, the rest against the name only.
+static bool matchAnyGlob(const char* const* patterns, u32 patternCount, const char* relativePath, const char* name)
+{
+    for(u32 i = 0; i < patternCount; i++)
+    {
+        const char* target = hasPathSeparator(patterns[i]) ? relativePath : name;
+        if(matchGlob(patterns[i], target))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// NOTE: Whether a scan would pick up the file, for paths that show up after it ran. Every folder on the way
+// is checked against the exclude patterns like the walkers do.
+static bool isScannedPath(const FileScanOptions* options, const char* relativePath)
+{
+    char path[MAX_SCAN_PATH];
+    if(snprintf(path, sizeof(path), "%s", relativePath) >= (s32)sizeof(path))
+    {
+        return false;
+    }
+    char* name = path;
+    for(char* c = path; *c; c++)
+    {
+        if(isPathSeparator(*c))
+        {
+            char separator = *c;
+            *c = 0;
+            bool isExcluded = matchAnyGlob(options->excludePatterns, options->excludeCount, path, name);
+            *c = separator;
+            if(!options->recursive || isExcluded)
+            {
+                return false;
+            }
+            name = c + 1;
+        }
+    }
+    
+    if(matchAnyGlob(options->excludePatterns, options->excludeCount, path, name))
+    {
+        return false;
+    }
+    if(options->includeCount == 0)
+    {
+        return matchGlob(defaultIncludePattern, name);
+    }
+    
+    return matchAnyGlob(options->includePatterns, options->includeCount, path, name);
+}
+
+// NOTE: Equal up to case and the kind of separators, like the file system compares them.
+static bool isSameScanPath(const char* a, const char* b)
+{
+    for(u32 i = 0; ; i++)
+    {
+        char ca = isPathSeparator(a[i]) ? '/' : toLowerAscii(a[i]);
+        char cb = isPathSeparator(b[i]) ? '/' : toLowerAscii(b[i]);
+        if(ca != cb)
+        {
+            return false;
+        }
+        if(!ca)
+        {
+            return true;
+        }
+    }
+}
+
+struct DirectoryWalk
+{
+    const char* rootPath;
+    u32 rootLength;
+    FileScanOptions* options;
+    
+    // NOTE: Directories waiting to be enumerated, shared by all the walkers.
+    SRWLOCK lock;
+    MemoryStack pendingPathArena;
+    MemoryStack pendingOffsetArena;
+    u32 pendingCount;
+    u32 activeCount;
+    
+    // NOTE: Idle walkers sleep on this, it's released for every queued directory and for every walker once the walk is done.
+    HANDLE wakeSemaphore;
+    u32 walkerCount;
+    
+    // NOTE: One output per thread so files are appended without contention.
+    FileList outputs[MAX_WORKER_THREADS];
+};
+
+static void pushPendingDirectory(DirectoryWalk* walk, const char* relativePath)
+{
+    AcquireSRWLockExclusive(&walk->lock);
+    u32 length = (u32)strlen(relativePath);
+    char* dest = PushArray(&walk->pendingPathArena, length + 1, char);
+    memcpy(dest, relativePath, length + 1);
+    u32* offset = (u32 *)GetAt(&walk->pendingOffsetArena, u32, walk->pendingCount);
+    if(walk->pendingCount == walk->pendingOffsetArena.elementCount)
+    {
+        offset = PushStruct(&walk->pendingOffsetArena, u32);
+    }
+    *offset = (u32)(dest - (char *)walk->pendingPathArena.base);
+    walk->pendingCount++;
+    ReleaseSRWLockExclusive(&walk->lock);
+    ReleaseSemaphore(walk->wakeSemaphore, 1, 0);
+}
+
+static void enumerateDirectory(DirectoryWalk* walk, const char* relativeDir, FileList* output)
+{
+    FileScanOptions* options = walk->options;
+    char searchPath[MAX_SCAN_PATH];
+    if(*relativeDir)
+    {
+        snprintf(searchPath, sizeof(searchPath), "%s\\%s\\*", walk->rootPath, relativeDir);
+    }
+    else
+    {
+        snprintf(searchPath, sizeof(searchPath), "%s\\*", walk->rootPath);
+    }
+    
+    WIN32_FIND_DATAA data;
+    HANDLE findHandle = FindFirstFileExA(searchPath, FindExInfoBasic, &data, FindExSearchNameMatch, 0, FIND_FIRST_EX_LARGE_FETCH);
+    if(findHandle == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+    
+    do
+    {
+        const char* name = data.cFileName;
+        if((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+        {
+            continue;
+        }
+        
+        char relativePath[MAX_SCAN_PATH];
+        s32 length;
+        if(*relativeDir)
+        {
+            length = snprintf(relativePath, sizeof(relativePath), "%s\\%s", relativeDir, name);
+        }
+        else
+        {
+            length = snprintf(relativePath, sizeof(relativePath), "%s", name);
+        }
+        // Joined to the root, with room for the "\*" of a search in it, or it would be cut short somewhere later.
+        if((length < 0) || (walk->rootLength + 1 + (u32)length + 2 >= MAX_SCAN_PATH))
+        {
+            fprintf(stderr, "Skipping %s%s%s, the path is longer than %u characters\n", relativeDir, *relativeDir ? "\\" : "", name, MAX_SCAN_PATH - 1);
+            continue;
+        }
+        
+        if(matchAnyGlob(options->excludePatterns, options->excludeCount, relativePath, name))
+        {
+            continue;
+        }
+        
+        if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            if(options->recursive)
+            {
+                pushPendingDirectory(walk, relativePath);
+            }
+        }
+        else if(matchAnyGlob(options->includePatterns, options->includeCount, relativePath, name))
+        {
+            appendToFileList(output, relativePath);
+        }
+    } while(FindNextFileA(findHandle, &data));
+    
+    FindClose(findHandle);
+}
+
+static WORK_QUEUE_CALLBACK(doDirectoryWalkWork)
+{
+    DirectoryWalk* walk = (DirectoryWalk *)data;
+    FileList* output = &walk->outputs[threadIndex];
+    if(!output->pathArena.base)
+    {
+        *output = makeFileList();
+    }
+    
+    for(;;)
+    {
+        char relativeDir[MAX_SCAN_PATH];
+        bool hasWork = false;
+        bool isDone = false;
+        
+        AcquireSRWLockExclusive(&walk->lock);
+        if(walk->pendingCount)
+        {
+            walk->pendingCount--;
+            u32 offset = *GetAt(&walk->pendingOffsetArena, u32, walk->pendingCount);
+            snprintf(relativeDir, sizeof(relativeDir), "%s", (const char *)walk->pendingPathArena.base + offset);
+            walk->activeCount++;
+            hasWork = true;
+        }
+        else
+        {
+            // Nothing queued and nobody left who could queue more.
+            isDone = (walk->activeCount == 0);
+        }
+        ReleaseSRWLockExclusive(&walk->lock);
+        
+        if(hasWork)
+        {
+            enumerateDirectory(walk, relativeDir, output);
+            
+            AcquireSRWLockExclusive(&walk->lock);
+            walk->activeCount--;
+            bool isLast = (walk->activeCount == 0) && (walk->pendingCount == 0);
+            ReleaseSRWLockExclusive(&walk->lock);
+            
+            if(isLast)
+            {
+                ReleaseSemaphore(walk->wakeSemaphore, walk->walkerCount, 0);
+            }
+        }
+        else if(isDone)
+        {
+            break;
+        }
+        else
+        {
+            // Someone is still enumerating, wait until they queue a directory or finish.
+            WaitForSingleObjectEx(walk->wakeSemaphore, INFINITE, FALSE);
+        }
+    }
+}
+
+// NOTE: Lowercase with '/' separators first, so the order is the same on every machine and file system.
+// The raw bytes break the ties left between names differing only in case.
+static s32 compareScanPaths(const void* p1, const void* p2)
+{
+    const char* a = *(const char **)p1;
+    const char* b = *(const char **)p2;
+    for(u32 i = 0; ; i++)
+    {
+        char ca = isPathSeparator(a[i]) ? '/' : toLowerAscii(a[i]);
+        char cb = isPathSeparator(b[i]) ? '/' : toLowerAscii(b[i]);
+        if(ca != cb)
+        {
+            return (s32)(u8)ca - (s32)(u8)cb;
+        }
+        if(!ca)
+        {
+            break;
+        }
+    }
+    
+    return strcmp(a, b);
+}
+
+static void sortFileList(FileList* list)
+{
+    MemoryStack pathPointers = InitGrowableStackMemory();
+    const char** paths = PushArray(&pathPointers, list->fileCount, const char*);
+    for(u32 i = 0; i < list->fileCount; i++)
+    {
+        paths[i] = getFileListPath(list, i);
+    }
+    // Every path is distinct, so the order is total and the sort needn't be stable.
+    qsort(paths, list->fileCount, sizeof(const char*), compareScanPaths);
+    
+    FileList sorted = makeFileList();
+    for(u32 i = 0; i < list->fileCount; i++)
+    {
+        appendToFileList(&sorted, paths[i]);
+    }
+    destroyFileList(list);
+    *list = sorted;
+    FreeMemoryStack(&pathPointers);
+}
+
+// NOTE: Walks the directory tree from all the worker threads, every directory is enumerated exactly once.
+static FileList scanFiles(const char* rootPath, FileScanOptions* options, WorkQueue* queue)
+{
+    if(strlen(rootPath) + 2 >= MAX_SCAN_PATH)
+    {
+        fprintf(stderr, "Skipping %s, the path is longer than %u characters\n", rootPath, MAX_SCAN_PATH - 1);
+        return makeFileList();
+    }
+    
+    FileScanOptions scanOptions = *options;
+    if(scanOptions.includeCount == 0)
+    {
+        scanOptions.includePatterns[scanOptions.includeCount++] = defaultIncludePattern;
+    }
+    
+    DirectoryWalk* walk = (DirectoryWalk *)VirtualAlloc(0, sizeof(DirectoryWalk), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    CountAllocation();
+    walk->options = &scanOptions;
+    InitializeSRWLock(&walk->lock);
+    walk->pendingPathArena = InitGrowableStackMemory();
+    walk->pendingOffsetArena = InitGrowableStackMemory();
+    walk->walkerCount = options->recursive ? queue->threadCount : 1;
+    walk->wakeSemaphore = CreateSemaphoreExA(0, 0, 0x7fffffff, 0, 0, SEMAPHORE_ALL_ACCESS);
+    
+    // Strip the trailing separator, paths get joined with one.
+    char root[MAX_SCAN_PATH];
+    snprintf(root, sizeof(root), "%s", rootPath);
+    size_t rootLength = strlen(root);
+    while((rootLength > 1) && isPathSeparator(root[rootLength - 1]))
+    {
+        root[--rootLength] = 0;
+    }
+    walk->rootPath = root;
+    walk->rootLength = (u32)rootLength;
+    
+    pushPendingDirectory(walk, "");
+    for(u32 i = 0; i < walk->walkerCount; i++)
+    {
+        addWorkQueueEntry(queue, doDirectoryWalkWork, walk);
+    }
+    completeAllWork(queue);
+    
+    FileList result = makeFileList();
+    for(u32 threadIndex = 0; threadIndex < MAX_WORKER_THREADS; threadIndex++)
+    {
+        FileList* output = &walk->outputs[threadIndex];
+        for(u32 i = 0; i < output->fileCount; i++)
+        {
+            appendToFileList(&result, getFileListPath(output, i));
+        }
+        destroyFileList(output);
+    }
+    
+    FreeMemoryStack(&walk->pendingPathArena);
+    FreeMemoryStack(&walk->pendingOffsetArena);
+    CloseHandle(walk->wakeSemaphore);
+    VirtualFree(walk, 0, MEM_RELEASE);
+    
+    if(options->sorted)
+    {
+        sortFileList(&result);
+    }
+    
+    return result;
+}
@@ -0,0 +1,212 @@
+//
+// work stealing job graph
+//
+
+// NOTE: Jobs form a dependency graph that is built up front and then run to completion by all the threads.
+// Every thread has its own deque, it pushes and pops at the bottom and steals from the top of the others.
+// A job becomes ready once all of the jobs it depends on have finished.
+
+struct JobGraph;
+
+#define JOB_CALLBACK(name) void name(void* data, u32 threadIndex)
+typedef JOB_CALLBACK(JobCallback);
+
+struct Job;
+
+struct JobLink
+{
+    Job* job;
+    JobLink* next;
+};
+
+struct Job
+{
+    JobCallback* callback;
+    void* data;
+    u32 volatile dependencyCount;  // NOTE: unfinished jobs this one waits for
+    JobLink* successors;
+};
+
+struct JobDeque
+{
+    SRWLOCK lock;
+    Job** jobs;
+    u32 capacity;
+    u32 top;        // NOTE: thieves take from here
+    u32 bottom;     // NOTE: the owner pushes and pops here
+};
+
+struct JobGraph
+{
+    MemoryStack jobArena;
+    MemoryStack linkArena;
+    u32 jobCount;
+    u32 volatile remainingCount;
+    u32 threadCount;
+    HANDLE readySemaphore;  // NOTE: released for every job that becomes ready and for every thread once the graph is done
+    JobDeque deques[MAX_WORKER_THREADS];
+};
+
+static JobGraph* makeJobGraph()
+{
+    JobGraph* result = (JobGraph *)VirtualAlloc(0, sizeof(JobGraph), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    CountAllocation();
+    result->jobArena = InitGrowableStackMemory();
+    result->linkArena = InitGrowableStackMemory();
+    
+    return result;
+}
+
+static void destroyJobGraph(JobGraph* graph)
+{
+    for(u32 threadIndex = 0; threadIndex < graph->threadCount; threadIndex++)
+    {
+        VirtualFree(graph->deques[threadIndex].jobs, 0, MEM_RELEASE);
+    }
+    FreeMemoryStack(&graph->jobArena);
+    FreeMemoryStack(&graph->linkArena);
+    VirtualFree(graph, 0, MEM_RELEASE);
+}
+
+static Job* addJob(JobGraph* graph, JobCallback* callback, void* data)
+{
+    Job* result = PushStruct(&graph->jobArena, Job);
+    result->callback = callback;
+    result->data = data;
+    result->dependencyCount = 0;
+    result->successors = nullptr;
+    graph->jobCount++;
+    
+    return result;
+}
+
+// NOTE: after starts only once before has finished. Only valid while the graph is being built.
+static void addJobDependency(JobGraph* graph, Job* before, Job* after)
+{
+    JobLink* link = PushStruct(&graph->linkArena, JobLink);
+    link->job = after;
+    link->next = before->successors;
+    before->successors = link;
+    after->dependencyCount++;
+}
+
+static void pushJob(JobDeque* deque, Job* job)
+{
+    AcquireSRWLockExclusive(&deque->lock);
+    deque->jobs[deque->bottom % deque->capacity] = job;
+    deque->bottom++;
+    ReleaseSRWLockExclusive(&deque->lock);
+}
+
+static Job* popJob(JobDeque* deque)
+{
+    Job* result = nullptr;
+    AcquireSRWLockExclusive(&deque->lock);
+    if(deque->bottom != deque->top)
+    {
+        deque->bottom--;
+        result = deque->jobs[deque->bottom % deque->capacity];
+    }
+    ReleaseSRWLockExclusive(&deque->lock);
+    
+    return result;
+}
+
+static Job* stealJob(JobDeque* deque)
+{
+    Job* result = nullptr;
+    // Don't queue up behind the owner, there are other deques to try.
+    if(TryAcquireSRWLockExclusive(&deque->lock))
+    {
+        if(deque->bottom != deque->top)
+        {
+            result = deque->jobs[deque->top % deque->capacity];
+            deque->top++;
+        }
+        ReleaseSRWLockExclusive(&deque->lock);
+    }
+    
+    return result;
+}
+
+static void runJob(JobGraph* graph, Job* job, u32 threadIndex)
+{
+    job->callback(job->data, threadIndex);
+    
+    // The successors that are ready now go to this thread, their input is still in its cache.
+    for(JobLink* link = job->successors; link; link = link->next)
+    {
+        if(InterlockedDecrement((LONG volatile *)&link->job->dependencyCount) == 0)
+        {
+            pushJob(&graph->deques[threadIndex], link->job);
+            ReleaseSemaphore(graph->readySemaphore, 1, 0);
+        }
+    }
+    if(InterlockedDecrement((LONG volatile *)&graph->remainingCount) == 0)
+    {
+        ReleaseSemaphore(graph->readySemaphore, graph->threadCount, 0);
+    }
+}
+
+static WORK_QUEUE_CALLBACK(doJobGraphWork)
+{
+    JobGraph* graph = (JobGraph *)data;
+    JobDeque* ownDeque = &graph->deques[threadIndex];
+    
+    while(graph->remainingCount)
+    {
+        Job* job = popJob(ownDeque);
+        for(u32 i = 1; !job && (i < graph->threadCount); i++)
+        {
+            job = stealJob(&graph->deques[(threadIndex + i) % graph->threadCount]);
+        }
+        
+        if(job)
+        {
+            runJob(graph, job, threadIndex);
+        }
+        else
+        {
+            // The jobs left are running or waiting on them, sleep until one of them makes another job ready.
+            WaitForSingleObjectEx(graph->readySemaphore, INFINITE, FALSE);
+        }
+    }
+}
+
+// NOTE: Runs every job of the graph on all the threads of the queue and returns once they have all finished.
+static void runJobGraph(JobGraph* graph, WorkQueue* queue)
+{
+    graph->threadCount = queue->threadCount;
+    graph->remainingCount = graph->jobCount;
+    graph->readySemaphore = CreateSemaphoreExA(0, 0, graph->jobCount + graph->threadCount, 0, 0, SEMAPHORE_ALL_ACCESS);
+    for(u32 threadIndex = 0; threadIndex < graph->threadCount; threadIndex++)
+    {
+        // A deque never holds more than every job of the graph, so the ring can't overflow.
+        JobDeque* deque = &graph->deques[threadIndex];
+        InitializeSRWLock(&deque->lock);
+        deque->capacity = max(graph->jobCount, 1u);
+        deque->jobs = (Job **)VirtualAlloc(0, deque->capacity*sizeof(Job*), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        CountAllocation();
+        deque->top = 0;
+        deque->bottom = 0;
+    }
+    
+    // Deal the jobs without dependencies out to all the threads.
+    Job* jobs = GetArrayElements(graph->jobArena, Job);
+    u32 nextThread = 0;
+    for(u32 i = 0; i < graph->jobCount; i++)
+    {
+        if(jobs[i].dependencyCount == 0)
+        {
+            pushJob(&graph->deques[nextThread], &jobs[i]);
+            nextThread = (nextThread + 1) % graph->threadCount;
+        }
+    }
+    
+    for(u32 i = 0; i < graph->threadCount; i++)
+    {
+        addWorkQueueEntry(queue, doJobGraphWork, graph);
+    }
+    completeAllWork(queue);
+    CloseHandle(graph->readySemaphore);
+}
@@ -1,10 +1,11 @@
 #include <cstdio>
+#include <stdarg.h>
 #include <stdint.h>
 #include <assert.h>
 #include <Windows.h>
+#include <psapi.h>
+#include <intrin.h>
 
-// For LRU cache.
-#include <unordered_map>
 
 
 #define KILOBYTES(Value) ((Value)*1024ULL)
@@ -12,6 +13,8 @@
 #define GIGABYTES(Value) ((MEGABYTES(Value)*1024ULL))
 #define TERABYTES(Value) ((GIGABYTES(Value)*1024ULL))
 
+#define ArrayCount(Array) (sizeof(Array) / sizeof((Array)[0]))
+
 #define insertAsFirstIntoList(sentinel, element)  \
 (element)->prev = (sentinel);       \
 (element)->next = (sentinel)->next; \
@@ -49,14 +52,151 @@ typedef float r32;
 typedef double r64;
 
 #include "dynamic_stack.cpp"
+#include "work_queue.cpp"
+#include "job_system.cpp"
+#include "file_scan.cpp"
+#include "string_table.cpp"
+#include "radix_sort.cpp"
+
+// NOTE: One scratch stack per thread, indexed like the work queue threads. Main thread is 0.
+static MemoryStack globalScratchArenas[MAX_WORKER_THREADS];
+
+// NOTE: The scratch stack stb_image allocates from on this thread, null falls back to the CRT heap.
+static thread_local MemoryStack* threadScratchArena;
+
+static MemoryStack* getScratchArena(u32 threadIndex)
+{
+    MemoryStack* result = &globalScratchArenas[threadIndex];
+    if(!result->base)
+    {
+        *result = InitGrowableStackMemory();
+    }
+    
+    return result;
+}
+
+#define SCRATCH_ALLOCATION_HEADER_SIZE 16
+
+static void* scratchAlloc(size_t size)
+{
+    void* result = nullptr;
+    if(threadScratchArena)
+    {
+        byte* header = PushSizeAligned(threadScratchArena, size + SCRATCH_ALLOCATION_HEADER_SIZE, byte, SCRATCH_ALLOCATION_HEADER_SIZE);
+        *(size_t *)header = size;
+        result = header + SCRATCH_ALLOCATION_HEADER_SIZE;
+    }
+    else
+    {
+        CountAllocation();
+        result = malloc(size);
+    }
+    
+    return result;
+}
+
+static void scratchFree(void* ptr)
+{
+    // Scratch blocks go away with the temporary memory around the decode, only heap blocks are freed.
+    if(ptr && !(threadScratchArena && IsInMemoryStack(threadScratchArena, ptr)))
+    {
+        free(ptr);
+    }
+}
+
+static void* scratchRealloc(void* ptr, size_t size)
+{
+    void* result = nullptr;
+    if(ptr && threadScratchArena && IsInMemoryStack(threadScratchArena, ptr))
+    {
+        size_t oldSize = *(size_t *)((byte *)ptr - SCRATCH_ALLOCATION_HEADER_SIZE);
+        // The block is on top of the stack, grow it in place.
+        if(((byte *)ptr + oldSize == (byte *)GetTopMemoryStack(threadScratchArena)) && (size >= oldSize))
+        {
+            PushSize(threadScratchArena, size - oldSize, byte);
+            threadScratchArena->elementCount--;
+            *(size_t *)((byte *)ptr - SCRATCH_ALLOCATION_HEADER_SIZE) = size;
+            result = ptr;
+        }
+        else
+        {
+            result = scratchAlloc(size);
+            memcpy(result, ptr, min(oldSize, size));
+        }
+    }
+    else if(ptr)
+    {
+        CountAllocation();
+        result = realloc(ptr, size);
+    }
+    else
+    {
+        result = scratchAlloc(size);
+    }
+    
+    return result;
+}
 
+#define STBI_MALLOC(size) scratchAlloc(size)
+#define STBI_REALLOC(ptr, size) scratchRealloc(ptr, size)
+#define STBI_FREE(ptr) scratchFree(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#include "png_decode.cpp"
+#include "png_encode.cpp"
+#include "pixel_convert.cpp"
+#include "sdf.cpp"
+#include "premultiply.cpp"
 
 static const char* globalFolderPath;
 
+struct ProgramOptions
+{
+    u32 threadCount;    // NOTE: 0 picks the number of logical processors
+    bool concurrentInsert;
+    bool twoPhase;      // NOTE: pack from the PNG headers, then decode straight into the atlas
+    bool frontCodedNames;   // NOTE: metadata names store the prefix length shared with the previous name
+    bool batch;         // NOTE: the path is a manifest of atlas groups instead of a folder
+    bool packSearch;    // NOTE: pack under several orders and start sizes and keep the best layout
+    bool fitPowerOfTwo; // NOTE: search the smallest power of two atlas that holds every texture
+    u32 fitMultiple;    // NOTE: or the smallest one with sides a multiple of this, 0 keeps the greedy growth
+    bool deterministic; // NOTE: byte identical output for identical input, with a content hash in the metadata
+    bool report;        // NOTE: write the packing quality, timings and memory of every atlas as JSON
+    bool overlay;       // NOTE: write a debug image of the free space and the placements of every atlas
+    bool validate;      // NOTE: check no placements overlap or leave the atlas
+    AtlasFormat atlasFormat;
+    u32 sdfSpread;      // NOTE: 0 packs the images as they are, otherwise distance in source pixels mapped to 0 and 255
+    u32 sdfDownscale;
+    u32 padding;        // NOTE: empty pixels around every texture and its extrusion, on each side
+    u32 extrude;        // NOTE: pixels the texture edges are replicated outward, the padding comes on top of them
+    bool premultiply;   // NOTE: multiply the colors by the alpha right after each sprite is decoded
+    bool srgb;          // NOTE: premultiply in linear light and encode back to srgb
+    bool stats;         // NOTE: print the time of every stage and the memory of the arenas
+    bool watch;         // NOTE: stay resident after the first atlas and update it as the textures change
+    bool serve;         // NOTE: the path is a pipe name, atlases are packed on request with the decoded textures kept warm
+    FileScanOptions scan;
+};
+
+static ProgramOptions globalOptions;
+
+// NOTE: Twice the border is added to u16 texture sizes, the options are bounded well below that.
+#define MAX_TEXTURE_PADDING 64
+#define MAX_TEXTURE_EXTRUDE 64
+
+// NOTE: The packer reserves every texture with this much around it on each side, the texture keeps its inner rect.
+static u16 getTextureBorder()
+{
+    return (u16)(globalOptions.padding + globalOptions.extrude);
+}
+
+// NOTE: Pinned instead of left to the stb_image_write defaults, so an update of it can't change cached atlases.
+// -1 picks the filter of every row by the same heuristic each time.
+#define DETERMINISTIC_PNG_COMPRESSION_LEVEL 8
+#define DETERMINISTIC_PNG_FILTER -1
+static WorkQueue globalWorkQueue;
+
 #define TIMER_RESOLUTION 1
 static u64 globalTimeFreq = 0;
 
@@ -89,40 +229,46 @@ static u64 getMicroseconds()
     return result;
 }
 
-struct FileHandle
-{
-    HANDLE win32Handle;
-    bool isError;
-};
-
-struct FileGroup
-{
-    u32 fileCount;
-    FileHandle handle;
-    WIN32_FIND_DATAA data;
-};
-
 struct Texture
 {
-    const char* fileName;
+    u32 fileNameOffset;     // NOTE: into the file name table, relative to the folder path
     void* memory;
-    u32 bpp;
+    u32 bpp;    // NOTE: of memory, or the channel count of the file while it is only probed
     u16 x;   // NOTE: in pixel coordinates
     u16 y;
     u16 width;
     u16 height;
+    volatile u32 isPlaced;  // NOTE: published last by the concurrent inserter, x and y are valid once set
+};
+
+// NOTE: Wall clock time of every stage of one atlas, stages that didn't run stay zero.
+struct AtlasReport
+{
+    u64 scanMicroseconds;
+    u64 loadMicroseconds;
+    u64 distanceFieldMicroseconds;
+    u64 premultiplyMicroseconds;    // NOTE: only a one phase run has a separate stage, two phase runs do it in the decode
+    u64 fitMicroseconds;
+    u64 searchMicroseconds;
+    u64 packMicroseconds;       // NOTE: includes the search and the fit, and the blit of a one phase run
+    u64 decodeMicroseconds;
+    u64 writeMicroseconds;
 };
 
 struct TextureAtlasMetadata
 {
+    const char* folderPath;     // NOTE: the textures are read from here and the atlas is written next to them
     MemoryStack textureArena;
     MemoryStack textureNodeArena;
-    MemoryStack fileNameArena;
+    StringTable fileNames;
+    MemoryStack pixelArena;
     u32 textureCount;
     u32 maxSize;
     u32 width;
     u32 height;
     u32 bpp;
+    AtlasFormat format;
+    AtlasReport report;
 };
 
 struct TextureRectangle
@@ -156,9 +302,51 @@ struct TextureNode
     TextureRectangle block;     
     Partition splitDir;
     bool isUsed;
-    bool isDrawn;
+    bool isEvicted;     // NOTE: the last texture placed here was evicted from the cache, only read by the debug overlay
+};
+
+// NOTE: Nodes visited on the way down to a free block, pushed onto a scratch stack.
+struct TextureNodePath
+{
+    MemoryStack* arena;
+    TemporaryMemory memory;
+    TextureNode** nodes;
+    u32 count;
 };
 
+static TextureNodePath beginTextureNodePath(MemoryStack* scratchArena)
+{
+    TextureNodePath result = {};
+    result.arena = scratchArena;
+    result.memory = BeginTemporaryMemory(scratchArena);
+    result.nodes = (TextureNode **)GetTopMemoryStack(scratchArena);
+    result.count = 0;
+    
+    return result;
+}
+
+static void pushTextureNodePath(TextureNodePath* path, TextureNode* node)
+{
+    TextureNode** slot = PushStruct(path->arena, TextureNode*);
+    assert(slot == path->nodes + path->count);
+    *slot = node;
+    path->count++;
+}
+
+static TextureNode* popTextureNodePath(TextureNodePath* path)
+{
+    path->count--;
+    TextureNode* result = *PopStruct(path->arena, TextureNode*);
+    
+    return result;
+}
+
+static void endTextureNodePath(TextureNodePath* path)
+{
+    EndTemporaryMemory(path->memory);
+    path->count = 0;
+}
+
 struct LRUNode
 {
     TextureNode* textureNode;
@@ -167,23 +355,159 @@ struct LRUNode
     LRUNode* next;
 };
 
+// NOTE: Robin Hood open addressing table keyed by texture pointer, lives in the LRU cache arena.
+struct LRUHashSlot
+{
+    Texture* key;
+    LRUNode* value;
+    u32 probeDistance;  // NOTE: 0 marks an empty slot, otherwise distance from the home slot + 1
+};
+
+struct LRUHashTable
+{
+    LRUHashSlot* slots;
+    u32 capacity;   // NOTE: always a power of two
+    u32 count;
+};
+
 struct LRUCache
 {
     LRUNode* sentinel;
-    std::unordered_map<Texture*, LRUNode*> hashLookup;
+    LRUNode* freeList;
+    LRUHashTable hashLookup;
     u16 atlasWidth;
     u16 atlasHeight;
     u32 nodeCount;
+    u32 evictionCount;
     MemoryStack arena;
 };
 
-static LRUCache makeLRUList(u32 listSize)
+static u32 hashTexturePointer(Texture* texture)
+{
+    u64 h = (u64)(uintptr_t)texture;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    
+    return (u32)h;
+}
+
+static u32 getLRUHashTableCapacity(u32 elementCount)
+{
+    // Keep the load factor at or below one half so probe sequences stay short.
+    u32 result = 16;
+    while(result < elementCount*2)
+    {
+        result <<= 1;
+    }
+    
+    return result;
+}
+
+static LRUHashSlot* findInLRUHashTable(LRUHashTable* table, Texture* key)
+{
+    LRUHashSlot* result = nullptr;
+    u32 mask = table->capacity - 1;
+    u32 index = hashTexturePointer(key) & mask;
+    for(u32 distance = 1; ; distance++)
+    {
+        LRUHashSlot* slot = &table->slots[index];
+        // An empty slot or a richer slot means the key cannot be further along.
+        if(slot->probeDistance < distance)
+        {
+            break;
+        }
+        if(slot->key == key)
+        {
+            result = slot;
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    
+    return result;
+}
+
+// NOTE: Single probe sequence for both the lookup and the insertion. Returns the slot holding the key.
+static LRUHashSlot* findOrInsertInLRUHashTable(LRUHashTable* table, Texture* key, bool* isNew)
+{
+    LRUHashSlot* result = nullptr;
+    u32 mask = table->capacity - 1;
+    u32 index = hashTexturePointer(key) & mask;
+    LRUHashSlot pending = {key, nullptr, 1};
+    *isNew = false;
+    
+    for(;;)
+    {
+        LRUHashSlot* slot = &table->slots[index];
+        if(slot->probeDistance == 0)
+        {
+            *slot = pending;
+            if(!result)
+            {
+                result = slot;
+            }
+            table->count++;
+            break;
+        }
+        if(!result && slot->key == key)
+        {
+            return slot;
+        }
+        // Steal from the rich: the key is not in the table past this point.
+        if(slot->probeDistance < pending.probeDistance)
+        {
+            LRUHashSlot displaced = *slot;
+            *slot = pending;
+            pending = displaced;
+            if(!result)
+            {
+                result = slot;
+            }
+        }
+        pending.probeDistance++;
+        index = (index + 1) & mask;
+    }
+    assert(table->count < table->capacity);
+    *isNew = true;
+    
+    return result;
+}
+
+static void removeFromLRUHashTable(LRUHashTable* table, LRUHashSlot* slot)
+{
+    // Backward shift deletion, no tombstones.
+    u32 mask = table->capacity - 1;
+    u32 index = (u32)(slot - table->slots);
+    for(;;)
+    {
+        u32 nextIndex = (index + 1) & mask;
+        LRUHashSlot* next = &table->slots[nextIndex];
+        if(next->probeDistance <= 1)
+        {
+            table->slots[index] = {};
+            break;
+        }
+        table->slots[index] = *next;
+        table->slots[index].probeDistance--;
+        index = nextIndex;
+    }
+    table->count--;
+}
+
+static LRUCache makeLRUList(u32 maxNodeCount)
 {
     LRUCache result = {};
     
+    u32 capacity = getLRUHashTableCapacity(maxNodeCount);
+    
     // +1 for the sentinel.
-    result.arena = InitStackMemory(listSize + sizeof(LRUNode));
+    result.arena = InitStackMemory(capacity*sizeof(LRUHashSlot) + (maxNodeCount + 1)*sizeof(LRUNode));
+    result.hashLookup.slots = PushArray(&result.arena, capacity, LRUHashSlot);
+    result.hashLookup.capacity = capacity;
+    result.hashLookup.count = 0;
     result.sentinel = PushStruct(&result.arena, LRUNode);
+    result.freeList = nullptr;
     initList(result.sentinel);
     
     return result;
@@ -192,31 +516,45 @@ static LRUCache makeLRUList(u32 listSize)
 static void clearLRUCache(LRUCache* cache)
 {
     printf("Clearing LRU cache\n");
-    u32 elementCount = cache->arena.elementCount;
-    for(u32 i = 0; i < elementCount; i++)
+    // Keep the hash slots and the sentinel, drop the nodes.
+    while(cache->arena.elementCount > 2)
     {
         PopStruct(&cache->arena, LRUNode);
     }
     cache->nodeCount = 0;
     cache->atlasWidth = 0;
     cache->atlasHeight = 0;
-    cache->hashLookup.clear();
+    cache->freeList = nullptr;
+    memset(cache->hashLookup.slots, 0, cache->hashLookup.capacity*sizeof(LRUHashSlot));
+    cache->hashLookup.count = 0;
     initList(cache->sentinel);
 }
 
 static void insertIntoLRUCache(TextureNode* textureNode, Texture* texture, LRUCache* cache, u16 currentAtlasWidth, u16 currentAtlasHeight)
 {
+    bool isNew;
+    LRUHashSlot* slot = findOrInsertInLRUHashTable(&cache->hashLookup, texture, &isNew);
+    
     // The node exists in the lookup table.
-    if(cache->hashLookup.find(texture) != cache->hashLookup.end())
+    if(!isNew)
     {
 //        printf("Moving an existing node to the head of cache[%ux%u]\n", texture->width, texture->height);
-        LRUNode* cachedNode = cache->hashLookup[texture];
+        LRUNode* cachedNode = slot->value;
         insertAsFirstIntoList(cache->sentinel, cachedNode);
     }
     else
     {
 //        printf("Inserting a new node as first into cache[%ux%u]\n", texture->width, texture->height);
-        LRUNode* cachedNode = PushStruct(&cache->arena, LRUNode);
+        // Reuse evicted nodes before growing the arena.
+        LRUNode* cachedNode = cache->freeList;
+        if(cachedNode)
+        {
+            cache->freeList = cachedNode->next;
+        }
+        else
+        {
+            cachedNode = PushStruct(&cache->arena, LRUNode);
+        }
         cachedNode->textureNode = textureNode;
         cachedNode->textureNode->isUsed = true;
         cachedNode->texture = texture;
@@ -225,12 +563,18 @@ static void insertIntoLRUCache(TextureNode* textureNode, Texture* texture, LRUCa
         cache->atlasWidth = currentAtlasWidth;
         cache->atlasHeight = currentAtlasHeight;
         
-        cache->hashLookup[texture] = cachedNode;
+        slot->value = cachedNode;
     }
 //    printf("Number of nodes in the cache: %u\n", cache->nodeCount);
 }
 
-static LRUNode* removeLRUFromCache(LRUCache* cache, std::vector<TextureNode*>* nodePath)
+static void freeLRUNode(LRUCache* cache, LRUNode* node)
+{
+    node->next = cache->freeList;
+    cache->freeList = node;
+}
+
+static LRUNode* removeLRUFromCache(LRUCache* cache, TextureNodePath* nodePath)
 {
     LRUNode* result = nullptr;
     
@@ -238,26 +582,29 @@ static LRUNode* removeLRUFromCache(LRUCache* cache, std::vector<TextureNode*>* n
     if(cache->nodeCount)
     {
         LRUNode* lruNode = cache->sentinel->prev;
+        LRUHashSlot* slot = findInLRUHashTable(&cache->hashLookup, lruNode->texture);
         // The LRU does exist in the lookup table.
-        if(cache->hashLookup.find(lruNode->texture) != cache->hashLookup.end())
+        if(slot)
         {
 //            printf("Removing LRU node from the cache[%ux%u]\n", lruNode->texture->width, lruNode->texture->height);
-            cache->hashLookup.erase(lruNode->texture);
+            removeFromLRUHashTable(&cache->hashLookup, slot);
             
             lruNode->textureNode->isUsed = false;
+            lruNode->textureNode->isEvicted = true;
             lruNode->textureNode->splitDir = Partition::NONE;
             // TODO: Readjust the subtree path from leaf to root of which the removed lru node is.
-            while(!nodePath->empty())
+            while(nodePath->count)
             {
-                TextureNode* node = nodePath->front();
+                TextureNode* node = popTextureNodePath(nodePath);
 //                printf("Node[%ux%u]\n", node->block.width, node->block.height);
-                nodePath->pop_back();
             }
             
             result = lruNode;
             removeLRUFromList(cache->sentinel);
+            freeLRUNode(cache, lruNode);
             
             cache->nodeCount--;
+            cache->evictionCount++;
         }
 //        printf("Number of nodes left in the cache: %u\n", cache->nodeCount);
     }
@@ -269,17 +616,19 @@ static void removeNodeFromCache(LRUCache* cache, LRUNode* node)
 {
     if(node && node->texture)
     {
-        if(cache->hashLookup.find(node->texture) == cache->hashLookup.end())
+        LRUHashSlot* slot = findInLRUHashTable(&cache->hashLookup, node->texture);
+        if(!slot)
         {
             return;
         }
-        cache->hashLookup.erase(node->texture);
+        removeFromLRUHashTable(&cache->hashLookup, slot);
         node->textureNode->isUsed = false;
         node->textureNode->left = nullptr;
         node->textureNode->right = nullptr;
         node->textureNode->splitDir = Partition::NONE;
         
         removeElementFromList(node);
+        freeLRUNode(cache, node);
         
         cache->nodeCount--;
     }
@@ -306,8 +655,21 @@ static void contractLRUCache(LRUCache* cache, u16 maxAtlasWidth, u16 maxAtlasHei
     }
 }
 
+// NOTE: Set by the server while it packs and writes a request on the main thread. The first error is then
+// sent back in the reply instead of stopping the server, every caller returns or carries on after reporting.
+static bool globalIsServingRequest;
+static const char* globalRequestError;
+
 static void reportError(const char* msg)
 {
+    if(globalIsServingRequest)
+    {
+        if(!globalRequestError)
+        {
+            globalRequestError = (strncmp(msg, "Error: ", 7) == 0) ? msg + 7 : msg;
+        }
+        return;
+    }
     MessageBoxA(0, msg, 0, 0); 
     DebugBreak();
 }
@@ -317,39 +679,96 @@ static void copyBytes(char* dest, const char* source)
     while(*dest++ = *source++) ;
 }
 
-static void setPathToWorkingDir(char* path)
+// NOTE: The path buffers hold MAX_SCAN_PATH bytes. A result that doesn't fit leaves the path empty and returns false,
+// so a caller that doesn't check opens nothing instead of a cut short path.
+static bool setPathToFolder(char* path, const char* folderPath)
 {
-    copyBytes(path, globalFolderPath);
+    size_t length = strlen(folderPath);
+    if(length >= MAX_SCAN_PATH)
+    {
+        *path = 0;
+        return false;
+    }
+    memcpy(path, folderPath, length + 1);
+    
+    return true;
 }
 
-static void appendToPath(char* string, const char* suffix)
+static bool appendToPath(char* path, const char* suffix)
 {
-    char* p = string;
-    while(*p++) ;
-    p--;
-    if(p[-1] != '\\')
+    size_t length = strlen(path);
+    size_t suffixLength = strlen(suffix);
+    bool needsSeparator = (length > 0) && (path[length - 1] != '\\');
+    if(length + needsSeparator + suffixLength >= MAX_SCAN_PATH)
     {
-        *p++ = '\\';
+        *path = 0;
+        return false;
     }
-    copyBytes(p, suffix);
+    if(needsSeparator)
+    {
+        path[length++] = '\\';
+    }
+    memcpy(path + length, suffix, suffixLength + 1);
+    
+    return true;
+}
+
+static bool buildFolderPath(char* path, const char* folderPath, const char* name)
+{
+    return setPathToFolder(path, folderPath) && appendToPath(path, name);
+}
+
+static bool buildTexturePath(char* path, TextureAtlasMetadata* atlasMetadata, const Texture* texture)
+{
+    return buildFolderPath(path, atlasMetadata->folderPath, getString(&atlasMetadata->fileNames, texture->fileNameOffset));
 }
 
 static void writeTextureAtlasMetadata(TextureAtlasMetadata* atlasMetadata, LRUCache* cache, char* atlasMetadataName)
 {
-    char atlasMetadataPath[MAX_PATH];
-    setPathToWorkingDir(atlasMetadataPath);
-    appendToPath(atlasMetadataPath, atlasMetadataName);
+    char atlasMetadataPath[MAX_SCAN_PATH];
+    if(!buildFolderPath(atlasMetadataPath, atlasMetadata->folderPath, atlasMetadataName))
+    {
+        reportError("Error: The atlas meta data path is too long");
+        return;
+    }
     FILE* atlasMetadataFile = fopen(atlasMetadataPath, "w");
     
     if(atlasMetadataFile)
     {
         fprintf(atlasMetadataFile, "Atlas meta data\n");
+        if(globalOptions.frontCodedNames)
+        {
+            fprintf(atlasMetadataFile, "Names front coded as <prefix length shared with the previous name>:<rest of the name>\n");
+        }
+        if(globalOptions.sdfSpread)
+        {
+            // The padding is spread source pixels on each side, the size is rounded up to a multiple of downscale.
+            fprintf(atlasMetadataFile, "Signed distance fields, spread %u, downscale %u, 128 on the edge and larger inside\n", globalOptions.sdfSpread, globalOptions.sdfDownscale);
+        }
+        if(globalOptions.premultiply)
+        {
+            fprintf(atlasMetadataFile, globalOptions.srgb ? "Premultiplied alpha, in linear light, srgb encoded\n" : "Premultiplied alpha\n");
+        }
+        if(getTextureBorder())
+        {
+            // The rects are the textures themselves, the border around them is reserved too.
+            fprintf(atlasMetadataFile, "Padding %u, extrude %u\n", globalOptions.padding, globalOptions.extrude);
+        }
         r32 atlasWidth = (r32)atlasMetadata->width;
         r32 atlasHeight = (r32)atlasMetadata->height;
+        char previousName[MAX_SCAN_PATH] = {};
         for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
         {
             const Texture* texture = node->texture;
-            const char* name = texture->fileName;
+            char name[MAX_SCAN_PATH];
+            buildTexturePath(name, atlasMetadata, texture);
+            if(globalOptions.frontCodedNames)
+            {
+                u32 prefixLength = getSharedPrefixLength(previousName, name);
+                fprintf(atlasMetadataFile, "%u:", prefixLength);
+                copyBytes(previousName, name);
+                copyBytes(name, previousName + prefixLength);
+            }
             u32 x = texture->x;
             u32 y = texture->y;
             u32 width = texture->width;
@@ -373,107 +792,180 @@ static void writeTextureAtlasMetadata(TextureAtlasMetadata* atlasMetadata, LRUCa
     }
 }
 
-static FileHandle* openNextFile(FileGroup* files) 
+// NOTE: read only view of a whole file, the handles are closed as soon as the view exists
+struct MappedFile
 {
-    FileHandle* result = nullptr;
-    if(files->handle.win32Handle != INVALID_HANDLE_VALUE)
-    {
-        result = (FileHandle *)VirtualAlloc(0, sizeof(FileHandle), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
-        if(result)
-        {
-            result->win32Handle = CreateFileA(files->data.cFileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-            result->isError = (result->win32Handle == INVALID_HANDLE_VALUE);
-        }
-        else
-        {
-            reportError("Error: Could not allocate memory for file");
-        }
-        if(!FindNextFileA(files->handle.win32Handle, &files->data))
-        {
-            FindClose(files->handle.win32Handle);
-            files->handle.win32Handle = INVALID_HANDLE_VALUE;
-        }
-    }
-    
-    return result;
-}
+    void* memory;
+    u32 size;
+};
 
-static FileGroup* createFileGroup(const char* path)
+static bool openMappedFile(const char* path, MappedFile* result)
 {
-    FileGroup* result = (FileGroup *)VirtualAlloc(0, sizeof(FileGroup), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
-    if(result)
+    *result = {};
+    HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if(fileHandle != INVALID_HANDLE_VALUE)
     {
-        WIN32_FIND_DATAA fd = {};
-        HANDLE h = FindFirstFileA(path, &fd);
-        while(h != INVALID_HANDLE_VALUE)
+        LARGE_INTEGER fileSize;
+        // Empty files cannot be mapped.
+        if(GetFileSizeEx(fileHandle, &fileSize) && (fileSize.QuadPart > 0) && (fileSize.QuadPart <= 0x7fffffff))
         {
-            result->fileCount++;
-            if(!FindNextFileA(h, &fd))
+            HANDLE mappingHandle = CreateFileMappingA(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+            if(mappingHandle)
             {
-                break;
+                result->memory = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+                result->size = (u32)fileSize.QuadPart;
+                // The view keeps the mapping alive.
+                CloseHandle(mappingHandle);
             }
         }
-        if(h != INVALID_HANDLE_VALUE)
-        {
-            FindClose(h);
-            result->handle.win32Handle = FindFirstFileA(path, &result->data);
-        }
-        else
-        {
-            reportError("Error: Could not find .png file(s) in the specified directory");
-        }
-        
+        CloseHandle(fileHandle);
     }
-    else
+    
+    return result->memory != nullptr;
+}
+
+static void closeMappedFile(MappedFile* file)
+{
+    if(file->memory)
     {
-        reportError("Error: Could not allocate memory for files");
+        UnmapViewOfFile(file->memory);
+        file->memory = nullptr;
+        file->size = 0;
     }
+}
+
+// NOTE: Not cryptographic, only a cache key. Eight bytes per round, the tail is padded with zeros
+// and the size is mixed in so the padding can't collide with real zeros.
+#define CONTENT_HASH_SEED 0x9e3779b97f4a7c15ULL
+
+static u64 mixContentHash(u64 hash, u64 word)
+{
+    hash ^= word*0xff51afd7ed558ccdULL;
+    hash = (hash << 31) | (hash >> 33);
     
-    return result;
+    return hash*0xc4ceb9fe1a85ec53ULL;
 }
 
-static void freeFileGroup(FileGroup* files)
+static u64 hashContent(u64 hash, const void* data, size_t size)
 {
-    if(files)
+    const byte* bytes = (const byte *)data;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8)
     {
-        VirtualFree(files, 0, MEM_RELEASE);
+        u64 word;
+        memcpy(&word, bytes + i, 8);
+        hash = mixContentHash(hash, word);
     }
+    u64 tail = 0;
+    memcpy(&tail, bytes + i, size - i);
+    hash = mixContentHash(hash, tail);
+    hash = mixContentHash(hash, (u64)size);
+    
+    return hash;
+}
+
+static u64 finalizeContentHash(u64 hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    
+    return hash;
 }
 
-static void closeFileGroup(FileGroup* files)
+// NOTE: Appends the hash of the atlas pixels and of everything already in the metadata file to it,
+// downstream caches compare it to skip atlases that didn't change.
+static void writeContentHash(Texture* atlas, TextureAtlasMetadata* atlasMetadata, const char* atlasMetadataName)
 {
-    if(files)
+    char atlasMetadataPath[MAX_SCAN_PATH];
+    if(!buildFolderPath(atlasMetadataPath, atlasMetadata->folderPath, atlasMetadataName))
+    {
+        reportError("Error: The atlas meta data path is too long");
+        return;
+    }
+    
+    u64 header[3] = {atlas->width, atlas->height, (u64)atlasMetadata->format};
+    u64 hash = hashContent(CONTENT_HASH_SEED, header, sizeof(header));
+    hash = hashContent(hash, atlas->memory, (size_t)atlas->width*atlas->height*atlas->bpp);
+    
+    MappedFile file;
+    if(!openMappedFile(atlasMetadataPath, &file))
+    {
+        reportError("Error: Unable to read back atlas meta data file");
+        return;
+    }
+    hash = finalizeContentHash(hashContent(hash, file.memory, file.size));
+    closeMappedFile(&file);
+    
+    FILE* atlasMetadataFile = fopen(atlasMetadataPath, "a");
+    if(atlasMetadataFile)
+    {
+        fprintf(atlasMetadataFile, "Content hash %016llx\n", hash);
+        fclose(atlasMetadataFile);
+        printf("Content hash %016llx\n", hash);
+    }
+    else
     {
-        FindClose(files->handle.win32Handle);
+        reportError("Error: Unable to write atlas meta data file");
     }
 }
 
-static void
-destroyFileGroup(FileGroup* files)
+// NOTE: What the textures are sorted by, the larger value goes first.
+enum struct TextureSortKey
 {
-    closeFileGroup(files);
-    freeFileGroup(files);
-}
+    HEIGHT,
+    WIDTH,
+    AREA,
+    MAX_SIDE,
+    PERIMETER,
+    HEIGHT_THEN_WIDTH,
+};
 
-static s32 compareHeight(const void* p1, const void* p2)
+static u32 getTextureSortValue(const Texture* texture, TextureSortKey key)
 {
-    s32 result = 0;
+    u32 width = texture->width;
+    u32 height = texture->height;
+    u32 result = 0;
+    switch(key)
+    {
+        case TextureSortKey::HEIGHT: result = height; break;
+        case TextureSortKey::WIDTH: result = width; break;
+        case TextureSortKey::AREA: result = width*height; break;
+        case TextureSortKey::MAX_SIDE: result = max(width, height); break;
+        case TextureSortKey::PERIMETER: result = width + height; break;
+        case TextureSortKey::HEIGHT_THEN_WIDTH: result = (height << 16) | width; break;
+    }
     
-    result = ((s32)((Texture *)p2)->height - (s32)((Texture *)p1)->height);
     return result;
 }
 
-static s32 compareWidth(const void* p1, const void* p2)
+// NOTE: Stable, ties keep their current order. The keys are the inverted sort value over the index of the
+// texture, radix sorted, and the textures are then moved once into their sorted places.
+static void sortTexturesByKey(Texture* textures, u32 textureCount, TextureSortKey key, MemoryStack* scratchArena)
 {
-    s32 result = 0;
+    TemporaryMemory sortMemory = BeginTemporaryMemory(scratchArena);
+    u64* keys = PushArray(scratchArena, textureCount, u64);
+    u64* temp = PushArray(scratchArena, textureCount, u64);
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        keys[i] = ((u64)~getTextureSortValue(&textures[i], key) << 32) | i;
+    }
+    radixSort64(keys, temp, textureCount);
     
-    result = ((s32)((Texture *)p2)->width - (s32)((Texture *)p1)->width);
-    return result;
+    Texture* sorted = PushArray(scratchArena, textureCount, Texture);
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        sorted[i] = textures[(u32)keys[i]];
+    }
+    memcpy(textures, sorted, textureCount*sizeof(Texture));
+    EndTemporaryMemory(sortMemory);
 }
 
-static void sortTexturesByHeight(TextureAtlasMetadata* atlasMetadataPath)
+static void sortTexturesByHeight(TextureAtlasMetadata* atlasMetadataPath, MemoryStack* scratchArena)
 {
-    qsort(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, sizeof(Texture), compareHeight);
+    sortTexturesByKey(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, TextureSortKey::HEIGHT, scratchArena);
 }
 
 enum struct Side
@@ -514,16 +1006,16 @@ static Side getLongerSide(Texture* textures, u32 textureCount)
     return result;
 }
 
-static void sortTextures(TextureAtlasMetadata* atlasMetadataPath)
+static void sortTextures(TextureAtlasMetadata* atlasMetadataPath, MemoryStack* scratchArena)
 {
     Side longerSide = getLongerSide(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount);
     if(longerSide == Side::HORIZONTAL)
     {
-        qsort(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, sizeof(Texture), compareWidth);
+        sortTexturesByKey(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, TextureSortKey::WIDTH, scratchArena);
     }
     else if(longerSide == Side::VERTICAL)
     {
-        qsort(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, sizeof(Texture), compareHeight);
+        sortTexturesByKey(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, TextureSortKey::HEIGHT, scratchArena);
     }
     else
     {
@@ -531,9 +1023,9 @@ static void sortTextures(TextureAtlasMetadata* atlasMetadataPath)
     }
 }
 
-static void sortTexturesByWidth(TextureAtlasMetadata* atlasMetadataPath)
+static void sortTexturesByWidth(TextureAtlasMetadata* atlasMetadataPath, MemoryStack* scratchArena)
 {
-    qsort(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, sizeof(Texture), compareWidth);
+    sortTexturesByKey(GetArrayElements(atlasMetadataPath->textureArena, Texture), atlasMetadataPath->textureArena.elementCount, TextureSortKey::WIDTH, scratchArena);
 }
 
 static bool isLeaf(TextureNode* node)
@@ -732,37 +1224,11 @@ static TextureNode* findFirstFreeRotatedBlock(TextureNode* node, MemoryStack* te
     return result;
 }
 
-static void renderBlockIntoTextureAtlas(TextureNode* node, Texture* textureAtlas)
-{
-    u32 atlasPitch = textureAtlas->width*textureAtlas->bpp;
-    u32 atlasBpp = textureAtlas->bpp;
-    u32 blockWidth = node->block.width;
-    u32 blockHeight = node->block.height;
-    
-//    printf("Rendering a block(%d,%d, %dx%d)\n", node->block.left, node->block.top, blockWidth, blockHeight);
-    
-    byte* atlasDestMemory = (byte *)textureAtlas->memory + (node->block.top * atlasPitch) + (node->block.left * atlasBpp);
-    u32* atlasDestPixel = (u32*)atlasDestMemory;
-    for(u32 i = 0; i < blockHeight; i++)
-    {
-        for(u32 j = 0; j < blockWidth; j++)
-        {
-            *atlasDestPixel++ = 0xffff00ff;
-        }
-        atlasDestMemory += atlasPitch;
-    }
-}
-
-static TextureNode* traverseTextureNodes(TextureNode* node, MemoryStack* textureNodeArena, Texture* textureAtlas, Texture* texture, std::vector<TextureNode*>* nodePath)
+static TextureNode* traverseTextureNodes(TextureNode* node, MemoryStack* textureNodeArena, Texture* texture, TextureNodePath* nodePath)
 {
     TextureNode* result = nullptr;
     while(node)
     {
-        if(!node->isUsed && !node->isDrawn)
-        {
-            renderBlockIntoTextureAtlas(node, textureAtlas);
-            node->isDrawn = true;
-        }
         if(isLeaf(node) && !node->isUsed)
         {
             // Visit the actual node.
@@ -784,16 +1250,16 @@ static TextureNode* traverseTextureNodes(TextureNode* node, MemoryStack* texture
             {
                 if((texture->height <= node->left->block.height))
                 {
-                    nodePath->push_back(node);
-                    result = traverseTextureNodes(node->left, textureNodeArena, textureAtlas, texture, nodePath);
+                    pushTextureNodePath(nodePath, node);
+                    result = traverseTextureNodes(node->left, textureNodeArena, texture, nodePath);
                 }
             }
             else if(node->splitDir == Partition::HORIZONTAL)
             {
                 if((texture->width <= node->left->block.width))
                 {
-                    nodePath->push_back(node);
-                    result = traverseTextureNodes(node->left, textureNodeArena, textureAtlas, texture, nodePath);
+                    pushTextureNodePath(nodePath, node);
+                    result = traverseTextureNodes(node->left, textureNodeArena, texture, nodePath);
                 }
             }
             // Take the first free block.
@@ -866,13 +1332,13 @@ static TextureNode* expandRootHorizontally(TextureNode* root, MemoryStack* textu
     return result;
 }
 
-static void packTexturesIntoAtlas(Texture* textures, MemoryStack* textureNodeArena, u32 textureCount, LRUCache* cache, Texture* textureAtlas)
+// NOTE: The root starts out as startingWidth by startingHeight and grows by whole textures up to the atlas size.
+static void packTexturesIntoAtlas(Texture* textures, MemoryStack* textureNodeArena, u32 textureCount, LRUCache* cache, Texture* textureAtlas, MemoryStack* scratchArena, u16 startingWidth, u16 startingHeight)
 {
     TextureNode* root = PushStruct(textureNodeArena, TextureNode);
     const u16 maxAtlasWidth = textureAtlas->width;
     const u16 maxAtlasHeight = textureAtlas->height;
-    u16 startingWidth = textures[0].width;
-    u16 startingHeight = textures[0].height;
+    const u16 border = getTextureBorder();
     root->left = nullptr;
     root->right = nullptr;
     root->block.left = 0;
@@ -886,36 +1352,40 @@ static void packTexturesIntoAtlas(Texture* textures, MemoryStack* textureNodeAre
     
     for(u32 textureIndex = 0; textureIndex < textureCount;)
     {
-        std::vector<TextureNode*> nodePath;
+        TextureNodePath nodePath = beginTextureNodePath(scratchArena);
         Texture* texture = &textures[textureIndex];
-        TextureNode* node = traverseTextureNodes(root, textureNodeArena, textureAtlas, texture, &nodePath);
+        Texture reserved = *texture;
+        reserved.width += 2*border;
+        reserved.height += 2*border;
+        TextureNode* node = traverseTextureNodes(root, textureNodeArena, &reserved, &nodePath);
         
         // Found a first free block in the texture atlas to fit the node.
         if(node)
         {
             textureIndex++;
-            texture->x = node->block.left;
-            texture->y = node->block.top;
+            texture->x = node->block.left + border;
+            texture->y = node->block.top + border;
             insertIntoLRUCache(node, texture, cache, root->block.width, root->block.height);
         }
         else
         {
-            u16 verticalExpansion = root->block.height + texture->height;
-            u16 horizontalExpansion = root->block.width + texture->width;
-            if((verticalExpansion < horizontalExpansion) && (verticalExpansion <= maxAtlasWidth))
+            u16 verticalExpansion = root->block.height + reserved.height;
+            u16 horizontalExpansion = root->block.width + reserved.width;
+            if((verticalExpansion < horizontalExpansion) && (verticalExpansion <= maxAtlasHeight))
             {
-                root = expandRootVertically(root, textureNodeArena, texture->height);
+                root = expandRootVertically(root, textureNodeArena, reserved.height);
             }
-            else if((verticalExpansion >= horizontalExpansion) && (horizontalExpansion <= maxAtlasHeight))
+            else if((verticalExpansion >= horizontalExpansion) && (horizontalExpansion <= maxAtlasWidth))
             {
-                root = expandRootHorizontally(root, textureNodeArena, texture->width);
+                root = expandRootHorizontally(root, textureNodeArena, reserved.width);
             }
-            else
+            else if(!removeLRUFromCache(cache, &nodePath))
             {
-                // Cannot expand anymore.
-                removeLRUFromCache(cache, &nodePath);
+                // Cannot expand anymore and nothing is left to evict, the texture can't be placed at all.
+                textureIndex++;
             }
         }
+        endTextureNodePath(&nodePath);
     }
     
     textureAtlas->width = min(root->block.width, maxAtlasWidth);
@@ -924,179 +1394,3381 @@ static void packTexturesIntoAtlas(Texture* textures, MemoryStack* textureNodeAre
     cache->atlasHeight = textureAtlas->height;
 }
 
-static void buildTextureAtlas(Texture* atlas, LRUCache* cache)
+//
+// pack search
+//
+
+// NOTE: The packer is greedy, how good the layout is depends mostly on the order the textures come in
+// and on the size the root starts at. The search packs the same textures under every order and start size,
+// each attempt on its own copy of the textures with its own node arena and cache, and keeps the best one.
+// The winner is then packed for real, the packer is deterministic so it lands on the same layout.
+
+enum struct PackOrder
 {
-    u32 atlasPitch = atlas->width*atlas->bpp;
-    u32 bpp = atlas->bpp;
-    
+    LONGER_SIDE,        // NOTE: what sortTextures picks
+    AREA,
+    MAX_SIDE,
+    PERIMETER,
+    HEIGHT_THEN_WIDTH,
+    RANDOM,             // NOTE: by area with every texture swapped a few places down, seeded
+};
+
+enum struct PackStart
+{
+    FIRST_TEXTURE,
+    TOTAL_AREA,         // NOTE: the square that would hold all the textures without any waste
+    ATLAS,
+};
+
+#define PACK_SEARCH_RANDOM_RESTARTS 8
+#define PACK_SEARCH_RANDOM_WINDOW 4
+
+struct PackAttempt
+{
+    PackOrder order;
+    PackStart start;
+    u32 seed;
+    u32 placedCount;
+    u64 placedArea;
+    u32 atlasArea;
+};
+
+static u32 nextPackSearchRandom(u32* state)
+{
+    // xorshift32, the state is never zero.
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    
+    return x;
+}
+
+// NOTE: The textures come in sorted by sortTextures, the same order and seed always give the same result.
+static void orderTexturesForPacking(Texture* textures, u32 textureCount, PackOrder order, u32 seed, MemoryStack* scratchArena)
+{
+    switch(order)
+    {
+        case PackOrder::AREA: sortTexturesByKey(textures, textureCount, TextureSortKey::AREA, scratchArena); break;
+        case PackOrder::MAX_SIDE: sortTexturesByKey(textures, textureCount, TextureSortKey::MAX_SIDE, scratchArena); break;
+        case PackOrder::PERIMETER: sortTexturesByKey(textures, textureCount, TextureSortKey::PERIMETER, scratchArena); break;
+        case PackOrder::HEIGHT_THEN_WIDTH: sortTexturesByKey(textures, textureCount, TextureSortKey::HEIGHT_THEN_WIDTH, scratchArena); break;
+        case PackOrder::RANDOM:
+        {
+            sortTexturesByKey(textures, textureCount, TextureSortKey::AREA, scratchArena);
+            u32 state = seed*0x9e3779b9u + 1;
+            for(u32 i = 0; i + 1 < textureCount; i++)
+            {
+                u32 j = i + nextPackSearchRandom(&state) % min(PACK_SEARCH_RANDOM_WINDOW, textureCount - i);
+                Texture swap = textures[i];
+                textures[i] = textures[j];
+                textures[j] = swap;
+            }
+        } break;
+        default: break;
+    }
+}
+
+// NOTE: Never smaller than the first texture with its border, it has to fit the root.
+static void getPackStartSize(const Texture* textures, u32 textureCount, PackStart start, u16 maxAtlasWidth, u16 maxAtlasHeight, u16* width, u16* height)
+{
+    u32 border = 2*getTextureBorder();
+    u32 startWidth = textures[0].width + border;
+    u32 startHeight = textures[0].height + border;
+    if(start == PackStart::TOTAL_AREA)
+    {
+        u64 totalArea = 0;
+        for(u32 i = 0; i < textureCount; i++)
+        {
+            totalArea += (u64)(textures[i].width + border)*(textures[i].height + border);
+        }
+        u32 side = (u32)ceil(sqrt((r64)totalArea));
+        startWidth = max(startWidth, min(side, (u32)maxAtlasWidth));
+        startHeight = max(startHeight, min(side, (u32)maxAtlasHeight));
+    }
+    else if(start == PackStart::ATLAS)
+    {
+        startWidth = max(startWidth, (u32)maxAtlasWidth);
+        startHeight = max(startHeight, (u32)maxAtlasHeight);
+    }
+    *width = (u16)startWidth;
+    *height = (u16)startHeight;
+}
+
+// NOTE: More texture area placed wins, then the smaller atlas, then the earlier attempt.
+static bool isBetterPackAttempt(const PackAttempt* a, const PackAttempt* b)
+{
+    if(a->placedArea != b->placedArea)
+    {
+        return a->placedArea > b->placedArea;
+    }
+    
+    return a->atlasArea < b->atlasArea;
+}
+
+static void runPackAttempt(PackAttempt* attempt, const Texture* textures, u32 textureCount, u16 maxAtlasWidth, u16 maxAtlasHeight, MemoryStack* scratchArena)
+{
+    TemporaryMemory attemptMemory = BeginTemporaryMemory(scratchArena);
+    Texture* attemptTextures = PushArray(scratchArena, textureCount, Texture);
+    memcpy(attemptTextures, textures, textureCount*sizeof(Texture));
+    orderTexturesForPacking(attemptTextures, textureCount, attempt->order, attempt->seed, scratchArena);
+    
+    u16 startWidth;
+    u16 startHeight;
+    getPackStartSize(attemptTextures, textureCount, attempt->start, maxAtlasWidth, maxAtlasHeight, &startWidth, &startHeight);
+    
+    MemoryStack textureNodeArena = InitGrowableStackMemory();
+    LRUCache cache = makeLRUList(textureCount);
+    Texture atlas = {};
+    atlas.width = maxAtlasWidth;
+    atlas.height = maxAtlasHeight;
+    packTexturesIntoAtlas(attemptTextures, &textureNodeArena, textureCount, &cache, &atlas, scratchArena, startWidth, startHeight);
+    
+    attempt->placedCount = cache.nodeCount;
+    attempt->placedArea = 0;
+    for(LRUNode* node = cache.sentinel->next; node != cache.sentinel; node = node->next)
+    {
+        attempt->placedArea += (u64)node->texture->width*node->texture->height;
+    }
+    attempt->atlasArea = (u32)atlas.width*atlas.height;
+    
+    FreeMemoryStack(&cache.arena);
+    FreeMemoryStack(&textureNodeArena);
+    EndTemporaryMemory(attemptMemory);
+}
+
+struct PackSearchWork
+{
+    PackAttempt* attempts;
+    u32 attemptCount;
+    u32 firstAttempt;
+    u32 stride;
+    const Texture* textures;
+    u32 textureCount;
+    u16 maxAtlasWidth;
+    u16 maxAtlasHeight;
+};
+
+static void packSearchStripe(PackSearchWork* work, u32 threadIndex)
+{
+    for(u32 i = work->firstAttempt; i < work->attemptCount; i += work->stride)
+    {
+        runPackAttempt(&work->attempts[i], work->textures, work->textureCount, work->maxAtlasWidth, work->maxAtlasHeight, getScratchArena(threadIndex));
+    }
+}
+
+static WORK_QUEUE_CALLBACK(doPackSearchWork)
+{
+    packSearchStripe((PackSearchWork *)data, threadIndex);
+}
+
+static JOB_CALLBACK(doPackSearchJob)
+{
+    packSearchStripe((PackSearchWork *)data, threadIndex);
+}
+
+static const PackOrder packSearchOrders[] = {PackOrder::LONGER_SIDE, PackOrder::AREA, PackOrder::MAX_SIDE, PackOrder::PERIMETER, PackOrder::HEIGHT_THEN_WIDTH};
+
+// NOTE: Every sort order with every start, nothing is run yet. A fixed size search only starts from the whole atlas,
+// the atlas size is already decided.
+static PackAttempt* makePackAttempts(MemoryStack* arena, bool fixedSize, u32* attemptCount)
+{
+    const PackStart searchStarts[] = {PackStart::FIRST_TEXTURE, PackStart::TOTAL_AREA, PackStart::ATLAS};
+    const PackStart fixedStarts[] = {PackStart::ATLAS};
+    const PackStart* starts = fixedSize ? fixedStarts : searchStarts;
+    u32 startCount = fixedSize ? ArrayCount(fixedStarts) : ArrayCount(searchStarts);
+    u32 orderCount = ArrayCount(packSearchOrders) + PACK_SEARCH_RANDOM_RESTARTS;
+    *attemptCount = orderCount*startCount;
+    PackAttempt* result = PushArray(arena, *attemptCount, PackAttempt);
+    for(u32 i = 0; i < *attemptCount; i++)
+    {
+        u32 orderIndex = i / startCount;
+        PackAttempt* attempt = &result[i];
+        *attempt = {};
+        attempt->order = (orderIndex < ArrayCount(packSearchOrders)) ? packSearchOrders[orderIndex] : PackOrder::RANDOM;
+        attempt->seed = (orderIndex < ArrayCount(packSearchOrders)) ? 0 : orderIndex - ArrayCount(packSearchOrders);
+        attempt->start = starts[i % startCount];
+    }
+    
+    return result;
+}
+
+static PackAttempt pickBestPackAttempt(const PackAttempt* attempts, u32 attemptCount)
+{
+    PackAttempt result = attempts[0];
+    for(u32 i = 1; i < attemptCount; i++)
+    {
+        if(isBetterPackAttempt(&attempts[i], &result))
+        {
+            result = attempts[i];
+        }
+    }
+    
+    return result;
+}
+
+// NOTE: Runs every attempt, spread over the queue, or on the calling thread when queue is null.
+static PackAttempt searchPackAttempts(const Texture* textures, u32 textureCount, u16 maxAtlasWidth, u16 maxAtlasHeight, bool fixedSize, WorkQueue* queue, u32 threadIndex)
+{
+    MemoryStack* scratchArena = getScratchArena(threadIndex);
+    TemporaryMemory searchMemory = BeginTemporaryMemory(scratchArena);
+    
+    u32 attemptCount;
+    PackAttempt* attempts = makePackAttempts(scratchArena, fixedSize, &attemptCount);
+    if(queue)
+    {
+        u32 workCount = min(attemptCount, queue->threadCount);
+        PackSearchWork* works = PushArray(scratchArena, workCount, PackSearchWork);
+        for(u32 workIndex = 0; workIndex < workCount; workIndex++)
+        {
+            PackSearchWork* work = &works[workIndex];
+            *work = {attempts, attemptCount, workIndex, workCount, textures, textureCount, maxAtlasWidth, maxAtlasHeight};
+            addWorkQueueEntry(queue, doPackSearchWork, work);
+        }
+        completeAllWork(queue);
+    }
+    else
+    {
+        PackSearchWork work = {attempts, attemptCount, 0, 1, textures, textureCount, maxAtlasWidth, maxAtlasHeight};
+        packSearchStripe(&work, threadIndex);
+    }
+    
+    PackAttempt result = pickBestPackAttempt(attempts, attemptCount);
+    EndTemporaryMemory(searchMemory);
+    
+    return result;
+}
+
+//
+// fixed size search
+//
+
+// NOTE: Candidate i is side(i - i/2) by side(i/2), the sides being powers of two or multiples of a step.
+// Each candidate holds the one before it, so whether the textures fit only flips once along the sequence
+// and the smallest fitting candidate can be found by bisection. The bisection splits the open range
+// into FIT_PROBES_PER_ROUND + 1 parts and probes all the cuts at once. The greedy packer doesn't
+// strictly hold to that, so the cut count doesn't depend on the thread count to keep the result the same.
+
+#define MAX_FIT_ATLAS_SIZE 8192
+#define FIT_PROBES_PER_ROUND 8
+
+static void getFitCandidateSize(u32 index, u32* width, u32* height)
+{
+    u32 widthStep = index - index/2;
+    u32 heightStep = index/2;
+    if(globalOptions.fitPowerOfTwo)
+    {
+        *width = 1u << widthStep;
+        *height = 1u << heightStep;
+    }
+    else
+    {
+        *width = (widthStep + 1)*globalOptions.fitMultiple;
+        *height = (heightStep + 1)*globalOptions.fitMultiple;
+    }
+}
+
+struct FitProbe
+{
+    u32 width;
+    u32 height;
+    bool fits;
+};
+
+// NOTE: A rect only pack per order from the whole atlas, the candidate fits once any order places everything.
+static void runFitProbe(FitProbe* probe, const Texture* textures, u32 textureCount, MemoryStack* scratchArena)
+{
+    probe->fits = false;
+    for(u32 i = 0; !probe->fits && (i < ArrayCount(packSearchOrders)); i++)
+    {
+        PackAttempt attempt = {};
+        attempt.order = packSearchOrders[i];
+        attempt.start = PackStart::ATLAS;
+        runPackAttempt(&attempt, textures, textureCount, (u16)probe->width, (u16)probe->height, scratchArena);
+        probe->fits = (attempt.placedCount == textureCount);
+    }
+}
+
+struct FitProbeWork
+{
+    FitProbe* probe;
+    const Texture* textures;
+    u32 textureCount;
+};
+
+static WORK_QUEUE_CALLBACK(doFitProbeWork)
+{
+    FitProbeWork* work = (FitProbeWork *)data;
+    runFitProbe(work->probe, work->textures, work->textureCount, getScratchArena(threadIndex));
+}
+
+// NOTE: Sets the atlas size of the metadata to the smallest candidate that fits all of its sorted textures.
+// Returns false when not even the largest candidate fits them.
+static bool fitTextureAtlasSize(TextureAtlasMetadata* atlasMetadata, WorkQueue* queue, u32 threadIndex)
+{
+    u64 fitStart = getMicroseconds();
+    const Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    u32 textureCount = atlasMetadata->textureArena.elementCount;
+    if(textureCount == 0)
+    {
+        return true;
+    }
+    
+    u64 totalArea = 0;
+    u32 maxTextureWidth = 0;
+    u32 maxTextureHeight = 0;
+    u32 border = 2*getTextureBorder();
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        totalArea += (u64)(textures[i].width + border)*(textures[i].height + border);
+        maxTextureWidth = max(maxTextureWidth, textures[i].width + border);
+        maxTextureHeight = max(maxTextureHeight, textures[i].height + border);
+    }
+    
+    // Every candidate up to low is too small for the largest texture or for the total area, high is the largest one.
+    u32 width;
+    u32 height;
+    u32 high = 0;
+    for(getFitCandidateSize(high + 1, &width, &height); (width <= MAX_FIT_ATLAS_SIZE) && (height <= MAX_FIT_ATLAS_SIZE); getFitCandidateSize(high + 1, &width, &height))
+    {
+        high++;
+    }
+    s32 low = -1;
+    for(getFitCandidateSize(low + 1, &width, &height); ((s32)high > low + 1) && ((width < maxTextureWidth) || (height < maxTextureHeight) || ((u64)width*height < totalArea)); getFitCandidateSize(low + 1, &width, &height))
+    {
+        low++;
+    }
+    
+    // The bisection only probes below high, so the largest candidate is probed on its own first.
+    MemoryStack* scratchArena = getScratchArena(threadIndex);
+    FitProbe largest = {};
+    getFitCandidateSize(high, &largest.width, &largest.height);
+    if((largest.width >= maxTextureWidth) && (largest.height >= maxTextureHeight) && ((u64)largest.width*largest.height >= totalArea))
+    {
+        TemporaryMemory probeMemory = BeginTemporaryMemory(scratchArena);
+        runFitProbe(&largest, textures, textureCount, scratchArena);
+        EndTemporaryMemory(probeMemory);
+    }
+    if(!largest.fits)
+    {
+        return false;
+    }
+    
+    u32 probeRounds = 0;
+    while((s32)high > low + 1)
+    {
+        TemporaryMemory roundMemory = BeginTemporaryMemory(scratchArena);
+        u32 range = high - (u32)(low + 1);
+        u32 probeCount = min((u32)FIT_PROBES_PER_ROUND, range);
+        FitProbe* probes = PushArray(scratchArena, probeCount, FitProbe);
+        FitProbeWork* works = PushArray(scratchArena, probeCount, FitProbeWork);
+        for(u32 i = 0; i < probeCount; i++)
+        {
+            u32 index = (u32)(low + 1) + (u32)(((u64)(i + 1)*range) / (probeCount + 1));
+            getFitCandidateSize(index, &probes[i].width, &probes[i].height);
+            works[i] = {&probes[i], textures, textureCount};
+            if(queue)
+            {
+                addWorkQueueEntry(queue, doFitProbeWork, &works[i]);
+            }
+            else
+            {
+                runFitProbe(&probes[i], textures, textureCount, scratchArena);
+            }
+        }
+        if(queue)
+        {
+            completeAllWork(queue);
+        }
+        
+        // The cuts are in increasing order, the first one that fits is the new high.
+        for(u32 i = 0; i < probeCount; i++)
+        {
+            u32 index = (u32)(low + 1) + (u32)(((u64)(i + 1)*range) / (probeCount + 1));
+            if(probes[i].fits)
+            {
+                high = index;
+                break;
+            }
+            low = (s32)index;
+        }
+        probeRounds++;
+        EndTemporaryMemory(roundMemory);
+    }
+    
+    getFitCandidateSize(high, &width, &height);
+    atlasMetadata->width = width;
+    atlasMetadata->height = height;
+    atlasMetadata->report.fitMicroseconds = getMicroseconds() - fitStart;
+    if(globalOptions.stats)
+    {
+        printf("Fitting the atlas size took %llu us in %u rounds, %ux%u\n", atlasMetadata->report.fitMicroseconds, probeRounds, width, height);
+    }
+    
+    return true;
+}
+
+static bool isPackSearched()
+{
+    return globalOptions.packSearch || globalOptions.fitPowerOfTwo || globalOptions.fitMultiple;
+}
+
+// NOTE: Packs in the order and from the start of the attempt, the textures are reordered when there was a search.
+static void packTexturesAsAttempt(TextureAtlasMetadata* atlasMetadata, LRUCache* cache, Texture* textureAtlas, const PackAttempt* attempt, u64 searchStart, u32 threadIndex)
+{
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    u32 textureCount = atlasMetadata->textureArena.elementCount;
+    if(isPackSearched())
+    {
+        atlasMetadata->report.searchMicroseconds = getMicroseconds() - searchStart;
+        if(globalOptions.stats)
+        {
+            printf("Pack search took %llu us, best placed %u textures in %u pixels\n", atlasMetadata->report.searchMicroseconds, attempt->placedCount, attempt->atlasArea);
+        }
+        orderTexturesForPacking(textures, textureCount, attempt->order, attempt->seed, getScratchArena(threadIndex));
+    }
+    
+    u16 startWidth;
+    u16 startHeight;
+    getPackStartSize(textures, textureCount, attempt->start, textureAtlas->width, textureAtlas->height, &startWidth, &startHeight);
+    packTexturesIntoAtlas(textures, &atlasMetadata->textureNodeArena, textureCount, cache, textureAtlas, getScratchArena(threadIndex), startWidth, startHeight);
+}
+
+// NOTE: Tree packs the sorted textures of the metadata, under the best order and start size when the search is on.
+static void packTextures(TextureAtlasMetadata* atlasMetadata, LRUCache* cache, Texture* textureAtlas, WorkQueue* queue, u32 threadIndex)
+{
+    u64 searchStart = getMicroseconds();
+    PackAttempt attempt = {};
+    if(isPackSearched())
+    {
+        Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+        bool isFixedSize = globalOptions.fitPowerOfTwo || globalOptions.fitMultiple;
+        attempt = searchPackAttempts(textures, atlasMetadata->textureArena.elementCount, textureAtlas->width, textureAtlas->height, isFixedSize, queue, threadIndex);
+    }
+    packTexturesAsAttempt(atlasMetadata, cache, textureAtlas, &attempt, searchStart, threadIndex);
+}
+
+// NOTE: Replicates the outermost pixels of the texture rows in [firstRow, endRow) extrude pixels outward, the
+// rows above and below copy the first and last row with their sides. Only pixels in the texture's own border are
+// written and the rows above and below are only read by the call that covers the first or last row,
+// so bands of rows can run on different threads.
+static void extrudeTextureRows(Texture* atlas, const Texture* texture, u32 firstRow, u32 endRow, u32 extrude)
+{
+    u32 bpp = atlas->bpp;
+    u32 atlasPitch = atlas->width*bpp;
+    u32 width = texture->width;
+    u32 left = min(extrude, (u32)texture->x);
+    u32 right = min(extrude, (u32)atlas->width - (texture->x + width));
+    u32 top = min(extrude, (u32)texture->y);
+    u32 bottom = min(extrude, (u32)atlas->height - (texture->y + texture->height));
+    byte* textureMemory = (byte *)atlas->memory + texture->y*atlasPitch + texture->x*bpp;
+    
+    FillPixelRun* fillPixelRun = getFillPixelRun(bpp);
+    byte* row = textureMemory + firstRow*atlasPitch;
+    for(u32 j = firstRow; j < endRow; j++)
+    {
+        fillPixelRun(row - left*bpp, row, left);
+        fillPixelRun(row + width*bpp, row + (width - 1)*bpp, right);
+        row += atlasPitch;
+    }
+    
+    u32 extrudedRowSize = (left + width + right)*bpp;
+    if(firstRow == 0)
+    {
+        byte* firstRowMemory = textureMemory - left*bpp;
+        for(u32 j = 1; j <= top; j++)
+        {
+            memcpy(firstRowMemory - j*atlasPitch, firstRowMemory, extrudedRowSize);
+        }
+    }
+    if(endRow == texture->height)
+    {
+        byte* lastRowMemory = textureMemory + (texture->height - 1)*atlasPitch - left*bpp;
+        for(u32 j = 1; j <= bottom; j++)
+        {
+            memcpy(lastRowMemory + j*atlasPitch, lastRowMemory, extrudedRowSize);
+        }
+    }
+}
+
+// NOTE: Copies the texture rows in [firstRow, endRow), the rows are relative to the texture.
+static void blitTextureRowsIntoAtlas(Texture* atlas, const Texture* texture, u32 firstRow, u32 endRow)
+{
+    u32 atlasPitch = atlas->width*atlas->bpp;
+    u32 bpp = atlas->bpp;
+    u32 texture_x = texture->x;
+    u32 texture_y = texture->y;
+    u32 width = texture->width;
+    byte* dest = (byte *)atlas->memory + (texture_y + firstRow)*atlasPitch + texture_x*bpp;
+    
+    u32 texturePitch = width*bpp;
+    byte* source = (byte *)texture->memory + firstRow*texturePitch;
+    for(u32 j = firstRow; j < endRow; j++)
+    {
+        memcpy(dest, source, width*bpp);
+        dest += atlasPitch;
+        source += texturePitch;
+    }
+    
+    if(globalOptions.extrude)
+    {
+        extrudeTextureRows(atlas, texture, firstRow, endRow, globalOptions.extrude);
+    }
+}
+
+static void blitTextureIntoAtlas(Texture* atlas, const Texture* texture)
+{
+    blitTextureRowsIntoAtlas(atlas, texture, 0, texture->height);
+}
+
+// NOTE: Each band owns a run of whole atlas rows, so no two threads ever write to the same row.
+struct BlitBandWork
+{
+    Texture* atlas;
+    Texture** textures;     // NOTE: the textures that touch the band
+    u32 textureCount;
+    u32 top;
+    u32 bottom;             // NOTE: one past the last row of the band
+};
+
+static JOB_CALLBACK(doBlitBandJob)
+{
+    BlitBandWork* work = (BlitBandWork *)data;
+    for(u32 i = 0; i < work->textureCount; i++)
+    {
+        const Texture* texture = work->textures[i];
+        u32 firstRow = (work->top > texture->y) ? work->top - texture->y : 0;
+        u32 endRow = min((u32)texture->height, work->bottom - texture->y);
+        blitTextureRowsIntoAtlas(work->atlas, texture, firstRow, endRow);
+    }
+}
+
+#define MIN_BLIT_BAND_HEIGHT 16
+
+// NOTE: Decided before packing from the largest the atlas can get, packing only ever trims it.
+static u32 getBlitBandCount(const Texture* atlas, u32 threadCount)
+{
+    u32 result = min(threadCount*4, (u32)atlas->height / MIN_BLIT_BAND_HEIGHT);
+    
+    return max(result, 1u);
+}
+
+// NOTE: Splits the packed atlas into bandCount bands of rows and hands each band the textures that touch it.
+// The bins live in workArena until the bands are blitted.
+static void binTexturesIntoBands(Texture* atlas, LRUCache* cache, BlitBandWork* bands, u32 bandCount, MemoryStack* workArena)
+{
+    u32 bandHeight = (atlas->height + bandCount - 1) / bandCount;
+    
+    // Bin the textures by the bands they touch, count first and then fill each band's slice of one array.
+    u32* firstInBand = PushArray(workArena, bandCount + 1, u32);
+    memset(firstInBand, 0, (bandCount + 1)*sizeof(u32));
+    u32 binnedCount = 0;
+    for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
+    {
+        const Texture* texture = node->texture;
+        u32 lastBand = min((u32)(texture->y + texture->height - 1) / bandHeight, bandCount - 1);
+        for(u32 band = texture->y / bandHeight; band <= lastBand; band++)
+        {
+            firstInBand[band + 1]++;
+            binnedCount++;
+        }
+    }
+    for(u32 band = 0; band < bandCount; band++)
+    {
+        firstInBand[band + 1] += firstInBand[band];
+    }
+    
+    Texture** binned = PushArray(workArena, binnedCount, Texture*);
+    u32* fillCount = PushArray(workArena, bandCount, u32);
+    memset(fillCount, 0, bandCount*sizeof(u32));
     for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
     {
-        const Texture* texture = node->texture;
-        u32 texture_x = texture->x;
-        u32 texture_y = texture->y;
-        u32 width = texture->width;
-        u32 height = texture->height;
-        byte* dest = (byte *)atlas->memory + texture_y*atlasPitch + texture_x*bpp;
-        
+        Texture* texture = node->texture;
+        u32 lastBand = min((u32)(texture->y + texture->height - 1) / bandHeight, bandCount - 1);
+        for(u32 band = texture->y / bandHeight; band <= lastBand; band++)
+        {
+            binned[firstInBand[band] + fillCount[band]++] = texture;
+        }
+    }
+    
+    for(u32 band = 0; band < bandCount; band++)
+    {
+        BlitBandWork* work = &bands[band];
+        work->atlas = atlas;
+        work->textures = binned + firstInBand[band];
+        work->textureCount = firstInBand[band + 1] - firstInBand[band];
+        work->top = band*bandHeight;
+        work->bottom = min((band + 1)*bandHeight, (u32)atlas->height);
+    }
+}
+
+// NOTE: The atlas is split into horizontal bands, each with its own node tree and lock.
+// Threads place into whichever band they can grab and blit outside of the lock.
+struct AtlasRegion
+{
+    SRWLOCK lock;
+    TextureNode* root;
+    MemoryStack textureNodeArena;
+};
+
+struct ConcurrentInsertWork;
+
+struct ConcurrentAtlas
+{
+    Texture* textureAtlas;
+    Texture* textures;
+    u32 textureCount;
+    AtlasRegion* regions;
+    TextureNode** placedNodes;  // NOTE: indexed like the texture array, for handing the placements to the LRU cache
+    u32 regionCount;
+    u32 volatile failedCount;
+    ConcurrentInsertWork* works;
+    u32 workCount;
+    MemoryStack arena;
+};
+
+struct ConcurrentInsertWork
+{
+    ConcurrentAtlas* atlas;
+    Texture* textures;
+    u32 textureCount;
+    u32 firstTexture;
+    u32 stride;
+};
+
+static bool insertTextureConcurrent(ConcurrentAtlas* atlas, Texture* texture, u32 textureIndex, u32 homeRegion, MemoryStack* scratchArena)
+{
+    TextureNode* node = nullptr;
+    u64 triedRegions = 0;
+    u16 border = getTextureBorder();
+    Texture reserved = *texture;
+    reserved.width += 2*border;
+    reserved.height += 2*border;
+    
+    // First pass skips contended regions, second pass waits for the ones not tried yet.
+    for(u32 pass = 0; (pass < 2) && !node; pass++)
+    {
+        for(u32 i = 0; (i < atlas->regionCount) && !node; i++)
+        {
+            u32 regionIndex = (homeRegion + i) % atlas->regionCount;
+            if(triedRegions & (1ULL << regionIndex))
+            {
+                continue;
+            }
+            AtlasRegion* region = &atlas->regions[regionIndex];
+            if(pass == 0)
+            {
+                if(!TryAcquireSRWLockExclusive(&region->lock))
+                {
+                    continue;
+                }
+            }
+            else
+            {
+                AcquireSRWLockExclusive(&region->lock);
+            }
+            
+            TextureNodePath nodePath = beginTextureNodePath(scratchArena);
+            node = traverseTextureNodes(region->root, &region->textureNodeArena, &reserved, &nodePath);
+            endTextureNodePath(&nodePath);
+            if(node)
+            {
+                texture->x = node->block.left + border;
+                texture->y = node->block.top + border;
+            }
+            ReleaseSRWLockExclusive(&region->lock);
+            triedRegions |= (1ULL << regionIndex);
+        }
+    }
+    
+    if(node)
+    {
+        // The block is owned by this thread now, no other insert can touch these pixels.
+        atlas->placedNodes[textureIndex] = node;
+        // Two phase runs only have the dimensions at this point.
+        if(texture->memory)
+        {
+            blitTextureIntoAtlas(atlas->textureAtlas, texture);
+        }
+        InterlockedExchange((LONG volatile *)&texture->isPlaced, 1);
+    }
+    else
+    {
+        InterlockedIncrement((LONG volatile *)&atlas->failedCount);
+    }
+    
+    return node != nullptr;
+}
+
+// NOTE: Wait-free, safe to call while other threads are still inserting.
+static bool lookupConcurrentPlacement(const Texture* texture, u16* x, u16* y)
+{
+    bool result = (texture->isPlaced != 0);
+    if(result)
+    {
+        _ReadWriteBarrier();
+        *x = texture->x;
+        *y = texture->y;
+    }
+    
+    return result;
+}
+
+static JOB_CALLBACK(doConcurrentInsertJob)
+{
+    ConcurrentInsertWork* work = (ConcurrentInsertWork *)data;
+    ConcurrentAtlas* atlas = work->atlas;
+    u32 homeRegion = (work->firstTexture + threadIndex) % atlas->regionCount;
+    MemoryStack* scratchArena = getScratchArena(threadIndex);
+    
+    for(u32 i = work->firstTexture; i < work->textureCount; i += work->stride)
+    {
+        insertTextureConcurrent(atlas, &work->textures[i], i, homeRegion, scratchArena);
+    }
+}
+
+// NOTE: Splits the atlas into regions and the textures into insert works, one job per work then places and blits them.
+static void beginConcurrentAtlas(ConcurrentAtlas* atlas, Texture* textures, u32 textureCount, Texture* textureAtlas, u32 threadCount)
+{
+    u16 maxTextureHeight = 1;
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        maxTextureHeight = max(maxTextureHeight, (u16)(textures[i].height + 2*getTextureBorder()));
+    }
+    
+    // Every band has to be able to hold the tallest texture.
+    u32 regionCount = min(threadCount, (u32)(textureAtlas->height / maxTextureHeight));
+    regionCount = max(min(regionCount, 64u), 1u);
+    u32 regionHeight = textureAtlas->height / regionCount;
+    
+    u32 workCount = min(textureCount, threadCount*4);
+    *atlas = {};
+    atlas->arena = InitStackMemory(regionCount*sizeof(AtlasRegion) + workCount*sizeof(ConcurrentInsertWork) + textureCount*sizeof(TextureNode*));
+    atlas->textureAtlas = textureAtlas;
+    atlas->textures = textures;
+    atlas->textureCount = textureCount;
+    atlas->regionCount = regionCount;
+    atlas->regions = PushArray(&atlas->arena, regionCount, AtlasRegion);
+    atlas->placedNodes = PushArray(&atlas->arena, textureCount, TextureNode*);
+    for(u32 regionIndex = 0; regionIndex < regionCount; regionIndex++)
+    {
+        AtlasRegion* region = &atlas->regions[regionIndex];
+        InitializeSRWLock(&region->lock);
+        region->textureNodeArena = InitGrowableStackMemory();
+        
+        u16 top = (u16)(regionIndex*regionHeight);
+        u16 bottom = (regionIndex == regionCount - 1) ? (u16)(textureAtlas->height - 1) : (u16)(top + regionHeight - 1);
+        TextureNode* root = PushStruct(&region->textureNodeArena, TextureNode);
+        root->block.left = 0;
+        root->block.top = top;
+        root->block.right = textureAtlas->width - 1;
+        root->block.bottom = bottom;
+        root->block.width = textureAtlas->width;
+        root->block.height = (bottom - top) + 1;
+        region->root = root;
+    }
+    
+    // Stride through the sorted textures so every job gets a mix of large and small ones.
+    atlas->workCount = workCount;
+    atlas->works = PushArray(&atlas->arena, workCount, ConcurrentInsertWork);
+    for(u32 workIndex = 0; workIndex < workCount; workIndex++)
+    {
+        ConcurrentInsertWork* work = &atlas->works[workIndex];
+        work->atlas = atlas;
+        work->textures = textures;
+        work->textureCount = textureCount;
+        work->firstTexture = workIndex;
+        work->stride = workCount;
+    }
+}
+
+// NOTE: Once every insert work has run, hands the placements to the LRU cache and trims the atlas.
+static void endConcurrentAtlas(ConcurrentAtlas* atlas, LRUCache* cache)
+{
+    Texture* textureAtlas = atlas->textureAtlas;
+    if(atlas->failedCount)
+    {
+        printf("Could not fit %u textures into the texture atlas\n", atlas->failedCount);
+    }
+    
+    // The placements are the inner rects, the border below the lowest textures is kept for their gutter and extrusion.
+    u16 usedHeight = 0;
+    for(u32 i = 0; i < atlas->textureCount; i++)
+    {
+        Texture* texture = &atlas->textures[i];
+        u16 x, y;
+        if(lookupConcurrentPlacement(texture, &x, &y))
+        {
+            u32 bottom = min((u32)y + texture->height + getTextureBorder(), (u32)textureAtlas->height);
+            usedHeight = max(usedHeight, (u16)bottom);
+            insertIntoLRUCache(atlas->placedNodes[i], texture, cache, textureAtlas->width, textureAtlas->height);
+        }
+    }
+    
+    // The pitch stays the same so only the height can be trimmed.
+    textureAtlas->height = usedHeight;
+    cache->atlasWidth = textureAtlas->width;
+    cache->atlasHeight = textureAtlas->height;
+    
+    for(u32 regionIndex = 0; regionIndex < atlas->regionCount; regionIndex++)
+    {
+        FreeMemoryStack(&atlas->regions[regionIndex].textureNodeArena);
+    }
+    FreeMemoryStack(&atlas->arena);
+}
+
+struct DecodeIntoAtlasWork
+{
+    Texture* textureAtlas;
+    TextureAtlasMetadata* atlasMetadata;
+    Texture** textures;
+    u32 textureCount;
+    u32 firstTexture;
+    u32 stride;
+};
+
+// NOTE: 16 bit formats decode with 16 bits per channel whatever the file has, so the conversion never narrows.
+static byte* decodeImageForFormat(const MappedFile* file, s32* width, s32* height, s32* channels, AtlasFormat format)
+{
+    byte* result;
+    if(isAtlasFormat16Bit(format))
+    {
+        result = (byte *)stbi_load_16_from_memory((stbi_uc *)file->memory, file->size, width, height, channels, 0);
+    }
+    else
+    {
+        result = stbi_load_from_memory((stbi_uc *)file->memory, file->size, width, height, channels, 0);
+    }
+    
+    return result;
+}
+
+static void decodeTextureIntoAtlas(Texture* textureAtlas, TextureAtlasMetadata* atlasMetadata, const Texture* texture, MemoryStack* scratchArena)
+{
+    char path[MAX_SCAN_PATH];
+    buildTexturePath(path, atlasMetadata, texture);
+    MappedFile file;
+    if(!openMappedFile(path, &file))
+    {
+        reportError("Error: Could not open .png file");
+        return;
+    }
+    
+    // Unfilter the scanlines right into the atlas rows when the format allows it.
+    bool isDecoded = false;
+    u32 atlasPitch = textureAtlas->width*textureAtlas->bpp;
+    byte* dest = (byte *)textureAtlas->memory + texture->y*atlasPitch + texture->x*textureAtlas->bpp;
+    if(isIdentityConversion(texture->bpp, atlasMetadata->format))
+    {
+        isDecoded = decodePNGIntoRows((byte *)file.memory, file.size, texture->width, texture->height, texture->bpp, dest, atlasPitch, scratchArena);
+    }
+    
+    if(!isDecoded)
+    {
+        s32 width;
+        s32 height;
+        s32 bpp;
+        byte* decoded = decodeImageForFormat(&file, &width, &height, &bpp, atlasMetadata->format);
+        // NOTE: The channel count may differ from the probed one, the probe stops at the header and doesn't see a tRNS chunk.
+        // The conversion is made for the decoded count.
+        if(decoded && (width == texture->width) && (height == texture->height))
+        {
+            PixelConversion conversion = makePixelConversion(bpp, atlasMetadata->format);
+            convertPixelRows(&conversion, decoded, width, height, dest, atlasPitch);
+            isDecoded = true;
+        }
+    }
+    closeMappedFile(&file);
+    
+    if(!isDecoded)
+    {
+        reportError("Error: Could not decode .png file or it changed since probing");
+        return;
+    }
+    
+    // Premultiplied before the extrude so the border copies the final colors.
+    if(globalOptions.premultiply)
+    {
+        premultiplyPixelRows(dest, texture->width, texture->height, atlasPitch, atlasMetadata->format, &globalPremultiplyTable);
+    }
+    if(globalOptions.extrude)
+    {
+        extrudeTextureRows(textureAtlas, texture, 0, texture->height, globalOptions.extrude);
+    }
+}
+
+static JOB_CALLBACK(doDecodeIntoAtlasJob)
+{
+    DecodeIntoAtlasWork* work = (DecodeIntoAtlasWork *)data;
+    threadScratchArena = getScratchArena(threadIndex);
+    
+    for(u32 i = work->firstTexture; i < work->textureCount; i += work->stride)
+    {
+        // Only the images in flight are ever resident, the scratch is rolled back after each one.
+        TemporaryMemory decodeMemory = BeginTemporaryMemory(threadScratchArena);
+        decodeTextureIntoAtlas(work->textureAtlas, work->atlasMetadata, work->textures[i], threadScratchArena);
+        EndTemporaryMemory(decodeMemory);
+    }
+    
+    threadScratchArena = nullptr;
+}
+
+// NOTE: Hands the decode stripes the textures that were placed, placedTextures has room for every texture.
+static void collectPlacedTextures(LRUCache* cache, Texture** placedTextures, DecodeIntoAtlasWork* decodeStripes, u32 decodeStripeCount)
+{
+    u32 textureCount = 0;
+    for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
+    {
+        placedTextures[textureCount++] = node->texture;
+    }
+    for(u32 i = 0; i < decodeStripeCount; i++)
+    {
+        decodeStripes[i].textureCount = textureCount;
+    }
+}
+
+// NOTE: Sorts the textures for packing and sizes the atlas at the maximum size, or at the smallest size
+// that fits them all when that is searched for. The atlas has no pixels yet.
+static Texture sizeTextureAtlas(TextureAtlasMetadata* atlasMetadata, WorkQueue* queue, u32 threadIndex)
+{
+    sortTextures(atlasMetadata, getScratchArena(threadIndex));
+    if(globalOptions.fitPowerOfTwo || globalOptions.fitMultiple)
+    {
+        if(!fitTextureAtlasSize(atlasMetadata, queue, threadIndex))
+        {
+            reportError("Error: The textures don't fit in the largest -fit atlas size");
+        }
+    }
+    
+    Texture result = {};
+    result.x = 0;
+    result.y = 0;
+    result.width = (u16)atlasMetadata->width;
+    result.height = (u16)atlasMetadata->height;
+    result.bpp = atlasMetadata->bpp;
+    
+    return result;
+}
+
+// NOTE: Sizes the atlas and allocates its zeroed pixels.
+static Texture beginTextureAtlas(TextureAtlasMetadata* atlasMetadata, WorkQueue* queue, u32 threadIndex)
+{
+    Texture result = sizeTextureAtlas(atlasMetadata, queue, threadIndex);
+    result.memory = PushSizeAligned(&atlasMetadata->textureArena, result.width * result.height * result.bpp, byte, 64);
+    memset(result.memory, 0, result.bpp * result.width * result.height);
+    atlasMetadata->textureArena.elementCount--;
+    
+    return result;
+}
+
+static void writeTextureAtlas(Texture* atlas, TextureAtlasMetadata* atlasMetadata, u32 textureCount, const char* fileName)
+{
+    char folderPath[MAX_SCAN_PATH];
+    if(!buildFolderPath(folderPath, atlasMetadata->folderPath, fileName))
+    {
+        reportError("Error: The texture atlas path is too long");
+        return;
+    }
+    int success;
+    if(isAtlasFormat16Bit(atlasMetadata->format))
+    {
+        success = writePNG16(folderPath, atlas->width, atlas->height, getAtlasFormatInfo(atlasMetadata->format)->channels, (byte *)atlas->memory, atlas->width*atlas->bpp);
+    }
+    else
+    {
+        success = stbi_write_png(folderPath, atlas->width, atlas->height, atlas->bpp, atlas->memory, 0);
+    }
+    if(success)
+    {
+        printf("Success writing texture atlas[%dx%d = %zu] of %d textures\n", atlas->width, atlas->height, (size_t)atlas->width*atlas->height, textureCount);
+    }
+    else
+    {
+        reportError("Error: Could not write texture atlas to disk");
+    }
+}
+
+// NOTE: Free leaves narrower or shorter than the smallest texture with its border can't hold anything, they are gutters.
+static void getSmallestTextureSize(TextureAtlasMetadata* atlasMetadata, u32* minWidth, u32* minHeight)
+{
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    u32 textureCount = atlasMetadata->textureArena.elementCount;
+    u32 border = 2*getTextureBorder();
+    *minWidth = 0xffff;
+    *minHeight = 0xffff;
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        *minWidth = min(*minWidth, textures[i].width + border);
+        *minHeight = min(*minHeight, textures[i].height + border);
+    }
+}
+
+// NOTE: Blocks hanging over the clamped atlas edge only count with the part inside, false when nothing is.
+static bool clipBlockToAtlas(const TextureRectangle* block, Texture* atlas, u32* width, u32* height)
+{
+    u32 right = min((u32)block->left + block->width, (u32)atlas->width);
+    u32 bottom = min((u32)block->top + block->height, (u32)atlas->height);
+    bool result = (right > block->left) && (bottom > block->top);
+    if(result)
+    {
+        *width = right - block->left;
+        *height = bottom - block->top;
+    }
+    
+    return result;
+}
+
+// NOTE: Free area the packer can't use for anything.
+static u64 getGutterArea(TextureAtlasMetadata* atlasMetadata, Texture* atlas)
+{
+    u32 minWidth;
+    u32 minHeight;
+    getSmallestTextureSize(atlasMetadata, &minWidth, &minHeight);
+    
+    u64 result = 0;
+    TextureNode* nodes = GetArrayElements(atlasMetadata->textureNodeArena, TextureNode);
+    for(u32 i = 0; i < atlasMetadata->textureNodeArena.elementCount; i++)
+    {
+        TextureNode* node = &nodes[i];
+        u32 width;
+        u32 height;
+        if(isLeaf(node) && !node->isUsed && clipBlockToAtlas(&node->block, atlas, &width, &height))
+        {
+            if((width < minWidth) || (height < minHeight))
+            {
+                result += (u64)width*height;
+            }
+        }
+    }
+    
+    return result;
+}
+
+// NOTE: Overlay colors, rgba bytes read as a little endian u32.
+#define OVERLAY_COLOR_BACKGROUND 0xff000000     // NOTE: outside the node tree, only where the atlas was fixed larger
+#define OVERLAY_COLOR_FREE 0xffff00ff           // NOTE: magenta, free space a texture could still go into
+#define OVERLAY_COLOR_GUTTER 0xff0080ff         // NOTE: orange, free space too narrow or short for any texture
+#define OVERLAY_COLOR_EVICTED 0xff0000ff        // NOTE: red, free again after the cache evicted its texture
+#define OVERLAY_COLOR_TEXTURE 0xff606060
+#define OVERLAY_COLOR_TEXTURE_EDGE 0xffc0c0c0   // NOTE: so textures side by side stay apart
+
+static void fillOverlayRect(u32* pixels, u32 pitch, u32 left, u32 top, u32 width, u32 height, u32 color)
+{
+    for(u32 y = top; y < top + height; y++)
+    {
+        u32* row = pixels + y*pitch;
+        for(u32 x = left; x < left + width; x++)
+        {
+            row[x] = color;
+        }
+    }
+}
+
+// NOTE: Debug image of the layout at the atlas size: the free leaves of the node tree colored by kind with the
+// placed textures on top. The concurrent inserter keeps its nodes per region, there only the textures show.
+static void writeTextureAtlasOverlay(Texture* atlas, TextureAtlasMetadata* atlasMetadata, LRUCache* cache, const char* overlayName)
+{
+    u32 width = atlas->width;
+    u32 height = atlas->height;
+    u32* pixels = (u32 *)VirtualAlloc(0, (size_t)width*height*sizeof(u32), MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    CountAllocation();
+    fillOverlayRect(pixels, width, 0, 0, width, height, OVERLAY_COLOR_BACKGROUND);
+    
+    u32 minWidth;
+    u32 minHeight;
+    getSmallestTextureSize(atlasMetadata, &minWidth, &minHeight);
+    TextureNode* nodes = GetArrayElements(atlasMetadata->textureNodeArena, TextureNode);
+    for(u32 i = 0; i < atlasMetadata->textureNodeArena.elementCount; i++)
+    {
+        TextureNode* node = &nodes[i];
+        u32 blockWidth;
+        u32 blockHeight;
+        if(isLeaf(node) && !node->isUsed && clipBlockToAtlas(&node->block, atlas, &blockWidth, &blockHeight))
+        {
+            u32 color = OVERLAY_COLOR_FREE;
+            if(node->isEvicted)
+            {
+                color = OVERLAY_COLOR_EVICTED;
+            }
+            else if((blockWidth < minWidth) || (blockHeight < minHeight))
+            {
+                color = OVERLAY_COLOR_GUTTER;
+            }
+            fillOverlayRect(pixels, width, node->block.left, node->block.top, blockWidth, blockHeight, color);
+        }
+    }
+    
+    for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
+    {
+        const Texture* texture = node->texture;
+        // Placements the validator would reject are clipped rather than drawn out of bounds.
+        if((texture->x >= width) || (texture->y >= height))
+        {
+            continue;
+        }
+        u32 textureWidth = min((u32)texture->width, width - texture->x);
+        u32 textureHeight = min((u32)texture->height, height - texture->y);
+        fillOverlayRect(pixels, width, texture->x, texture->y, textureWidth, textureHeight, OVERLAY_COLOR_TEXTURE_EDGE);
+        if((textureWidth > 2) && (textureHeight > 2))
+        {
+            fillOverlayRect(pixels, width, texture->x + 1, texture->y + 1, textureWidth - 2, textureHeight - 2, OVERLAY_COLOR_TEXTURE);
+        }
+    }
+    
+    char overlayPath[MAX_SCAN_PATH];
+    if(!buildFolderPath(overlayPath, atlasMetadata->folderPath, overlayName) || !stbi_write_png(overlayPath, width, height, 4, pixels, 0))
+    {
+        reportError("Error: Could not write texture atlas overlay to disk");
+    }
+    VirtualFree(pixels, 0, MEM_RELEASE);
+}
+
+// NOTE: Coverage counts over the compressed y intervals. A node's pending count applies to its whole range,
+// its max is the largest count under it including the pending one, so nothing is ever pushed down.
+struct CoverageTree
+{
+    s32* maxCoverage;
+    s32* pendingCoverage;
+    u32 intervalCount;
+};
+
+static void addCoverage(CoverageTree* tree, u32 node, u32 nodeFirst, u32 nodeEnd, u32 first, u32 end, s32 delta)
+{
+    if((end <= nodeFirst) || (nodeEnd <= first))
+    {
+        return;
+    }
+    if((first <= nodeFirst) && (nodeEnd <= end))
+    {
+        tree->pendingCoverage[node] += delta;
+        tree->maxCoverage[node] += delta;
+        return;
+    }
+    
+    u32 middle = (nodeFirst + nodeEnd) / 2;
+    addCoverage(tree, 2*node, nodeFirst, middle, first, end, delta);
+    addCoverage(tree, 2*node + 1, middle, nodeEnd, first, end, delta);
+    tree->maxCoverage[node] = tree->pendingCoverage[node] + max(tree->maxCoverage[2*node], tree->maxCoverage[2*node + 1]);
+}
+
+static s32 getMaxCoverage(CoverageTree* tree, u32 node, u32 nodeFirst, u32 nodeEnd, u32 first, u32 end)
+{
+    if((end <= nodeFirst) || (nodeEnd <= first))
+    {
+        return 0;
+    }
+    if((first <= nodeFirst) && (nodeEnd <= end))
+    {
+        return tree->maxCoverage[node];
+    }
+    
+    u32 middle = (nodeFirst + nodeEnd) / 2;
+    s32 result = max(getMaxCoverage(tree, 2*node, nodeFirst, middle, first, end), getMaxCoverage(tree, 2*node + 1, middle, nodeEnd, first, end));
+    
+    return tree->pendingCoverage[node] + result;
+}
+
+// NOTE: Index of value in the sorted, unique ys.
+static u32 findCoordinate(const u64* ys, u32 count, u64 value)
+{
+    u32 first = 0;
+    while(count)
+    {
+        u32 half = count / 2;
+        if(ys[first + half] < value)
+        {
+            first += half + 1;
+            count -= half + 1;
+        }
+        else
+        {
+            count = half;
+        }
+    }
+    
+    return first;
+}
+
+// NOTE: Checks every placed texture lies inside the atlas and no two of them overlap, in O(n log n).
+// A sweep left to right over the texture edges keeps the y intervals of the textures it is inside of in a
+// coverage tree, a texture that starts where the coverage isn't zero overlaps one already there.
+static bool validateTexturePlacements(Texture* atlas, TextureAtlasMetadata* atlasMetadata, LRUCache* cache, MemoryStack* scratchArena)
+{
+    TemporaryMemory validateMemory = BeginTemporaryMemory(scratchArena);
+    u32 count = cache->nodeCount;
+    const Texture** placed = PushArray(scratchArena, count, const Texture*);
+    u32 errorCount = 0;
+    u32 i = 0;
+    for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
+    {
+        const Texture* texture = node->texture;
+        placed[i++] = texture;
+        if(((u32)texture->x + texture->width > atlas->width) || ((u32)texture->y + texture->height > atlas->height))
+        {
+            char name[MAX_SCAN_PATH];
+            buildTexturePath(name, atlasMetadata, texture);
+            printf("Texture %s at (%u, %u) %ux%u is outside the %ux%u atlas\n", name, texture->x, texture->y, texture->width, texture->height, atlas->width, atlas->height);
+            errorCount++;
+        }
+    }
+    
+    // Events sort by x, ends before starts at the same x since touching textures don't overlap.
+    u64* events = PushArray(scratchArena, 2*count, u64);
+    u64* ys = PushArray(scratchArena, 2*count, u64);
+    u64* temp = PushArray(scratchArena, 2*count, u64);
+    for(i = 0; i < count; i++)
+    {
+        const Texture* texture = placed[i];
+        events[2*i] = ((u64)texture->x << 33) | ((u64)1 << 32) | i;
+        events[2*i + 1] = ((u64)(texture->x + texture->width) << 33) | i;
+        ys[2*i] = texture->y;
+        ys[2*i + 1] = (u64)texture->y + texture->height;
+    }
+    radixSort64(events, temp, 2*count);
+    radixSort64(ys, temp, 2*count);
+    u32 yCount = 0;
+    for(i = 0; i < 2*count; i++)
+    {
+        if((yCount == 0) || (ys[yCount - 1] != ys[i]))
+        {
+            ys[yCount++] = ys[i];
+        }
+    }
+    
+    CoverageTree tree = {};
+    tree.intervalCount = yCount ? yCount - 1 : 0;
+    u32 treeSize = 4*max(tree.intervalCount, 1u);
+    tree.maxCoverage = PushArray(scratchArena, treeSize, s32);
+    tree.pendingCoverage = PushArray(scratchArena, treeSize, s32);
+    memset(tree.maxCoverage, 0, treeSize*sizeof(s32));
+    memset(tree.pendingCoverage, 0, treeSize*sizeof(s32));
+    for(i = 0; i < 2*count; i++)
+    {
+        const Texture* texture = placed[(u32)events[i]];
+        bool isStart = (events[i] >> 32) & 1;
+        u32 first = findCoordinate(ys, yCount, texture->y);
+        u32 end = findCoordinate(ys, yCount, (u64)texture->y + texture->height);
+        if(isStart)
+        {
+            if(getMaxCoverage(&tree, 1, 0, tree.intervalCount, first, end) > 0)
+            {
+                char name[MAX_SCAN_PATH];
+                buildTexturePath(name, atlasMetadata, texture);
+                printf("Texture %s at (%u, %u) %ux%u overlaps another texture\n", name, texture->x, texture->y, texture->width, texture->height);
+                errorCount++;
+            }
+            addCoverage(&tree, 1, 0, tree.intervalCount, first, end, 1);
+        }
+        else
+        {
+            addCoverage(&tree, 1, 0, tree.intervalCount, first, end, -1);
+        }
+    }
+    
+    EndTemporaryMemory(validateMemory);
+    if(errorCount)
+    {
+        printf("%u invalid texture placements\n", errorCount);
+        reportError("Error: Texture atlas placements overlap or leave the atlas");
+    }
+    else
+    {
+        printf("Validated %u texture placements\n", count);
+    }
+    
+    return errorCount == 0;
+}
+
+// NOTE: One flat JSON object per atlas, the keys don't change between builds so dashboards can track them.
+// NOTE: null when the packer didn't keep what the figure is counted from.
+static void writeReportCount(FILE* reportFile, const char* name, u64 value, bool isKnown)
+{
+    if(isKnown)
+    {
+        fprintf(reportFile, "  \"%s\": %llu,\n", name, value);
+    }
+    else
+    {
+        fprintf(reportFile, "  \"%s\": null,\n", name);
+    }
+}
+
+static void writeTextureAtlasReport(Texture* atlas, TextureAtlasMetadata* atlasMetadata, LRUCache* cache, const char* reportName)
+{
+    char reportPath[MAX_SCAN_PATH];
+    FILE* reportFile = buildFolderPath(reportPath, atlasMetadata->folderPath, reportName) ? fopen(reportPath, "w") : nullptr;
+    if(!reportFile)
+    {
+        reportError("Error: Unable to write atlas report file");
+        return;
+    }
+    
+    u64 atlasArea = (u64)atlas->width*atlas->height;
+    u64 usedArea = 0;
+    for(LRUNode* node = cache->sentinel->next; node != cache->sentinel; node = node->next)
+    {
+        usedArea += (u64)node->texture->width*node->texture->height;
+    }
+    u32 leafCount = 0;
+    u32 usedLeafCount = 0;
+    TextureNode* nodes = GetArrayElements(atlasMetadata->textureNodeArena, TextureNode);
+    for(u32 i = 0; i < atlasMetadata->textureNodeArena.elementCount; i++)
+    {
+        if(isLeaf(&nodes[i]))
+        {
+            leafCount++;
+            usedLeafCount += nodes[i].isUsed ? 1 : 0;
+        }
+    }
+    // The concurrent packer keeps its nodes per region and frees them once placing is done.
+    bool hasNodes = !globalOptions.concurrentInsert;
+    PROCESS_MEMORY_COUNTERS memoryCounters = {};
+    memoryCounters.cb = sizeof(memoryCounters);
+    K32GetProcessMemoryInfo(GetCurrentProcess(), &memoryCounters, sizeof(memoryCounters));
+    
+    const AtlasReport* report = &atlasMetadata->report;
+    fprintf(reportFile, "{\n");
+    fprintf(reportFile, "  \"textureCount\": %u,\n", atlasMetadata->textureArena.elementCount);
+    fprintf(reportFile, "  \"placedCount\": %u,\n", cache->nodeCount);
+    fprintf(reportFile, "  \"evictionCount\": %u,\n", cache->evictionCount);
+    fprintf(reportFile, "  \"format\": \"%s\",\n", getAtlasFormatInfo(atlasMetadata->format)->name);
+    fprintf(reportFile, "  \"width\": %u,\n", (u32)atlas->width);
+    fprintf(reportFile, "  \"height\": %u,\n", (u32)atlas->height);
+    fprintf(reportFile, "  \"atlasArea\": %llu,\n", atlasArea);
+    fprintf(reportFile, "  \"usedArea\": %llu,\n", usedArea);
+    fprintf(reportFile, "  \"freeArea\": %llu,\n", atlasArea - usedArea);
+    writeReportCount(reportFile, "gutterArea", hasNodes ? getGutterArea(atlasMetadata, atlas) : 0, hasNodes);
+    fprintf(reportFile, "  \"occupancy\": %.6f,\n", atlasArea ? (r64)usedArea / (r64)atlasArea : 0.0);
+    writeReportCount(reportFile, "nodeCount", atlasMetadata->textureNodeArena.elementCount, hasNodes);
+    writeReportCount(reportFile, "leafCount", leafCount, hasNodes);
+    writeReportCount(reportFile, "usedLeafCount", usedLeafCount, hasNodes);
+    fprintf(reportFile, "  \"scanMicroseconds\": %llu,\n", report->scanMicroseconds);
+    fprintf(reportFile, "  \"loadMicroseconds\": %llu,\n", report->loadMicroseconds);
+    fprintf(reportFile, "  \"distanceFieldMicroseconds\": %llu,\n", report->distanceFieldMicroseconds);
+    fprintf(reportFile, "  \"premultiplyMicroseconds\": %llu,\n", report->premultiplyMicroseconds);
+    fprintf(reportFile, "  \"fitMicroseconds\": %llu,\n", report->fitMicroseconds);
+    fprintf(reportFile, "  \"searchMicroseconds\": %llu,\n", report->searchMicroseconds);
+    fprintf(reportFile, "  \"packMicroseconds\": %llu,\n", report->packMicroseconds);
+    fprintf(reportFile, "  \"decodeMicroseconds\": %llu,\n", report->decodeMicroseconds);
+    fprintf(reportFile, "  \"writeMicroseconds\": %llu,\n", report->writeMicroseconds);
+    fprintf(reportFile, "  \"texturePeakBytes\": %zu,\n", atlasMetadata->textureArena.high_water_mark);
+    fprintf(reportFile, "  \"textureNodePeakBytes\": %zu,\n", atlasMetadata->textureNodeArena.high_water_mark);
+    fprintf(reportFile, "  \"pixelPeakBytes\": %zu,\n", atlasMetadata->pixelArena.high_water_mark);
+    fprintf(reportFile, "  \"fileNamePeakBytes\": %zu,\n", atlasMetadata->fileNames.stringArena.high_water_mark);
+    fprintf(reportFile, "  \"processPeakWorkingSetBytes\": %zu\n", (size_t)memoryCounters.PeakWorkingSetSize);
+    fprintf(reportFile, "}\n");
+    fclose(reportFile);
+}
+
+static void loadFiles(const char* rootPath, FileList* files, MemoryStack* textureArena, StringTable* fileNames, MemoryStack* pixelArena, u32 textureCount, AtlasFormat format, bool probeOnly, MemoryStack* scratchArena)
+{
+    char folderPath[MAX_SCAN_PATH];
+    
+    // stb_image allocates from the calling thread's scratch stack, the pixels are kept in the pixel arena.
+    threadScratchArena = scratchArena;
+    u64 decodeStart = getMicroseconds();
+    u64 decodeAllocations = globalAllocationCount;
+    
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        const char* relativePath = getFileListPath(files, i);
+        // The scan only keeps paths that fit once joined to the root, one that didn't would fail to open below.
+        buildFolderPath(folderPath, rootPath, relativePath);
+        u32 fileNameOffset = internString(fileNames, relativePath);
+        
+        s32 width;
+        s32 height;
+        s32 bpp;
+        TemporaryMemory decodeMemory = BeginTemporaryMemory(threadScratchArena);
+        byte* decoded = nullptr;
+        MappedFile file;
+        bool isValid = false;
+        if(openMappedFile(folderPath, &file))
+        {
+            if(probeOnly)
+            {
+                // Only the IHDR chunk is read.
+                isValid = stbi_info_from_memory((stbi_uc *)file.memory, file.size, &width, &height, &bpp) != 0;
+            }
+            else
+            {
+                decoded = decodeImageForFormat(&file, &width, &height, &bpp, format);
+                isValid = (decoded != nullptr);
+            }
+            closeMappedFile(&file);
+        }
+        
+        if(isValid)
+        {
+            byte* memory = nullptr;
+            if(decoded)
+            {
+                // Converted straight out of the decoder's buffer, whatever the channel count of the file.
+                PixelConversion conversion = makePixelConversion(bpp, format);
+                size_t textureSize = (size_t)width*height*conversion.destPixelBytes;
+                memory = PushSizeAligned(pixelArena, textureSize, byte, 16);
+                convertPixels(&conversion, decoded, memory, width*height);
+                bpp = conversion.destPixelBytes;
+            }
+            
+            Texture* tex = PushStruct(textureArena, Texture);
+            tex->width = (u16)width;
+            tex->height = (u16)height;
+            tex->bpp = bpp;
+            tex->memory = memory;
+            tex->fileNameOffset = fileNameOffset;
+        }
+        else
+        {
+            reportError("Error: Could not load .png file");
+        }
+        EndTemporaryMemory(decodeMemory);
+    }
+    
+    threadScratchArena = nullptr;
+    if(globalOptions.stats)
+    {
+        printf("Loading %u files took %llu us with %llu allocations\n", textureCount, getMicroseconds() - decodeStart, globalAllocationCount - decodeAllocations);
+    }
+}
+
+struct SignedDistanceFieldWork
+{
+    Texture* textures;
+    byte** fields;
+    u32 textureCount;
+    u32 firstTexture;
+    u32 stride;
+    u32 spread;
+    u32 downscale;
+};
+
+static WORK_QUEUE_CALLBACK(doSignedDistanceFieldWork)
+{
+    SignedDistanceFieldWork* work = (SignedDistanceFieldWork *)data;
+    MemoryStack* scratchArena = getScratchArena(threadIndex);
+    for(u32 i = work->firstTexture; i < work->textureCount; i += work->stride)
+    {
+        Texture* texture = &work->textures[i];
+        computeSignedDistanceField((byte *)texture->memory, texture->width, texture->height, work->spread, work->downscale, work->fields[i], scratchArena);
+        
+        SignedDistanceFieldSize size = getSignedDistanceFieldSize(texture->width, texture->height, work->spread, work->downscale);
+        texture->memory = work->fields[i];
+        texture->width = (u16)size.width;
+        texture->height = (u16)size.height;
+    }
+}
+
+struct PremultiplyWork
+{
+    Texture* textures;
+    u32 textureCount;
+    u32 firstTexture;
+    u32 stride;
+    AtlasFormat format;
+};
+
+static JOB_CALLBACK(doPremultiplyJob)
+{
+    PremultiplyWork* work = (PremultiplyWork *)data;
+    for(u32 i = work->firstTexture; i < work->textureCount; i += work->stride)
+    {
+        Texture* texture = &work->textures[i];
+        premultiplyPixelRows((byte *)texture->memory, texture->width, texture->height, texture->width*texture->bpp, work->format, &globalPremultiplyTable);
+    }
+}
+
+// NOTE: Replaces every loaded sprite with its distance field, the sprites must be in a one byte format.
+// The fields are allocated up front so the worker threads never touch the pixel arena.
+static void generateSignedDistanceFields(TextureAtlasMetadata* atlasMetadata, u32 spread, u32 downscale, WorkQueue* queue)
+{
+    u64 sdfStart = getMicroseconds();
+    MemoryStack* scratchArena = getScratchArena(0);
+    TemporaryMemory workMemory = BeginTemporaryMemory(scratchArena);
+    
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    u32 textureCount = atlasMetadata->textureArena.elementCount;
+    byte** fields = PushArray(scratchArena, max(textureCount, 1u), byte*);
+    for(u32 i = 0; i < textureCount; i++)
+    {
+        assert(textures[i].bpp == 1);
+        SignedDistanceFieldSize size = getSignedDistanceFieldSize(textures[i].width, textures[i].height, spread, downscale);
+        fields[i] = PushSizeAligned(&atlasMetadata->pixelArena, (size_t)size.width*size.height, byte, 16);
+    }
+    
+    u32 workCount = min(textureCount, queue->threadCount*4);
+    SignedDistanceFieldWork* works = PushArray(scratchArena, max(workCount, 1u), SignedDistanceFieldWork);
+    for(u32 workIndex = 0; workIndex < workCount; workIndex++)
+    {
+        SignedDistanceFieldWork* work = &works[workIndex];
+        work->textures = textures;
+        work->fields = fields;
+        work->textureCount = textureCount;
+        work->firstTexture = workIndex;
+        work->stride = workCount;
+        work->spread = spread;
+        work->downscale = downscale;
+        addWorkQueueEntry(queue, doSignedDistanceFieldWork, work);
+    }
+    completeAllWork(queue);
+    
+    EndTemporaryMemory(workMemory);
+    atlasMetadata->report.distanceFieldMicroseconds = getMicroseconds() - sdfStart;
+    if(globalOptions.stats)
+    {
+        printf("Distance fields of %u textures took %llu us\n", textureCount, atlasMetadata->report.distanceFieldMicroseconds);
+    }
+}
+
+static void destroyTextureAtlasMetadata(TextureAtlasMetadata *atlasMetadata)
+{
+    FreeMemoryStack(&atlasMetadata->textureArena);
+    FreeMemoryStack(&atlasMetadata->pixelArena);
+    FreeMemoryStack(&atlasMetadata->textureNodeArena);
+    destroyStringTable(&atlasMetadata->fileNames);
+}
+
+static FileList scanTextureFiles(const char* folderPath, FileScanOptions* scanOptions)
+{
+    u64 scanStart = getMicroseconds();
+    FileList result = scanFiles(folderPath, scanOptions, &globalWorkQueue);
+    if(globalOptions.stats)
+    {
+        printf("Scanning found %u files in %llu us\n", result.fileCount, getMicroseconds() - scanStart);
+    }
+    if(result.fileCount == 0)
+    {
+        reportError("Error: Could not find .png file(s) in the specified directory");
+    }
+    
+    return result;
+}
+
+// NOTE: Loads the scanned files, the caller keeps ownership of the file list.
+static TextureAtlasMetadata makeTextureAtlasMetadata(const char* folderPath, FileList* files, u32 width, u32 height, AtlasFormat format, bool probeOnly, MemoryStack* scratchArena)
+{
+    TextureAtlasMetadata result = {};
+    result.folderPath = folderPath;
+    
+    const u32 textureCount = files->fileCount;
+    const u32 bpp = getAtlasFormatBytesPerPixel(format);
+    const u32 textureAtlasSize = width * height * bpp;
+    
+    // Only address space is reserved up front, the stacks commit what they actually use.
+    MemoryStack textureArena = InitGrowableStackMemory(max(DEFAULT_STACK_RESERVE, textureCount * sizeof(Texture) + textureAtlasSize + 64));
+    
+    MemoryStack textureNodeArena = InitGrowableStackMemory();
+    
+    StringTable fileNames = makeStringTable(textureCount);
+    
+    MemoryStack pixelArena = InitGrowableStackMemory(GIGABYTES(16));
+    
+    u64 loadStart = getMicroseconds();
+    loadFiles(folderPath, files, &textureArena, &fileNames, &pixelArena, textureCount, format, probeOnly, scratchArena);
+    result.report.loadMicroseconds = getMicroseconds() - loadStart;
+    result.textureArena = textureArena;
+    result.pixelArena = pixelArena;
+    result.textureNodeArena = textureNodeArena;
+    result.fileNames = fileNames;
+    result.maxSize = textureAtlasSize;
+    result.textureCount = textureCount;
+    
+    result.width = width;
+    result.height = height;
+    result.bpp = bpp;
+    result.format = format;
+    
+    return result;
+}
+
+static TextureAtlasMetadata generateTextureAtlasMetadata(const char* folderPath, FileScanOptions* scanOptions, u32 width, u32 height, AtlasFormat format, bool probeOnly)
+{
+    u64 scanStart = getMicroseconds();
+    FileList files = scanTextureFiles(folderPath, scanOptions);
+    u64 scanMicroseconds = getMicroseconds() - scanStart;
+    TextureAtlasMetadata result = makeTextureAtlasMetadata(folderPath, &files, width, height, format, probeOnly, getScratchArena(0));
+    result.report.scanMicroseconds = scanMicroseconds;
+    destroyFileList(&files);
+    
+    return result;
+}
+
+//
+// batch mode
+//
+
+// NOTE: A manifest has one group per line: name, folder, then the scan options of that group.
+// Blank lines and lines starting with '#' are skipped, tokens with spaces can be quoted.
+//
+//     ui      assets/ui       -recursive
+//     fonts   assets/fonts    -include *_sdf.png
+//     level1  "assets/level 1" -exclude unused\**
+//
+// Every group writes <name>.png and <name>Metadata.txt into its folder.
+
+#define MAX_MANIFEST_LINE 4096
+
+struct AtlasGroup
+{
+    const char* name;
+    const char* folderPath;
+    FileScanOptions scan;
+    FileList files;
+    u64 scanMicroseconds;
+    u64 packEnd;        // NOTE: the decode stripes of the group run from here until the write job starts
+    TextureAtlasMetadata atlasMetadata;
+    LRUCache cache;
+    Texture textureAtlas;
+    
+    // NOTE: filled in by the pack job, the decode stripes read them once it has finished.
+    Texture** placedTextures;
+    DecodeIntoAtlasWork* decodeStripes;
+    u32 decodeStripeCount;
+};
+
+static char* nextManifestToken(char** cursor)
+{
+    char* p = *cursor;
+    while((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n'))
+    {
+        p++;
+    }
+    if(!*p)
+    {
+        *cursor = p;
+        return nullptr;
+    }
+    
+    char* result = p;
+    if(*p == '"')
+    {
+        result = ++p;
+        while(*p && (*p != '"'))
+        {
+            p++;
+        }
+    }
+    else
+    {
+        while(*p && (*p != ' ') && (*p != '\t') && (*p != '\r') && (*p != '\n'))
+        {
+            p++;
+        }
+    }
+    if(*p)
+    {
+        *p++ = 0;
+    }
+    *cursor = p;
+    
+    return result;
+}
+
+static bool parseManifestLine(char* line, AtlasGroup* group)
+{
+    char* cursor = line;
+    group->name = nextManifestToken(&cursor);
+    group->folderPath = nextManifestToken(&cursor);
+    if(!group->name || !group->folderPath)
+    {
+        return false;
+    }
+    
+    // The command line scan options apply to every group, the line adds to them.
+    group->scan = globalOptions.scan;
+    for(char* option = nextManifestToken(&cursor); option; option = nextManifestToken(&cursor))
+    {
+        if(strcmp(option, "-recursive") == 0)
+        {
+            group->scan.recursive = true;
+        }
+        else if((strcmp(option, "-include") == 0) && (group->scan.includeCount < MAX_SCAN_PATTERNS))
+        {
+            group->scan.includePatterns[group->scan.includeCount] = nextManifestToken(&cursor);
+            if(!group->scan.includePatterns[group->scan.includeCount++])
+            {
+                return false;
+            }
+        }
+        else if((strcmp(option, "-exclude") == 0) && (group->scan.excludeCount < MAX_SCAN_PATTERNS))
+        {
+            group->scan.excludePatterns[group->scan.excludeCount] = nextManifestToken(&cursor);
+            if(!group->scan.excludePatterns[group->scan.excludeCount++])
+            {
+                return false;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown group option: %s\n", option);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// NOTE: The groups are pushed on the batch arena, their names and patterns point into the line arena.
+static u32 readManifest(const char* manifestPath, MemoryStack* batchArena, MemoryStack* lineArena)
+{
+    FILE* manifestFile = fopen(manifestPath, "r");
+    if(!manifestFile)
+    {
+        reportError("Error: Could not open the manifest file");
+        return 0;
+    }
+    
+    // The relative group folders are resolved against the folder of the manifest, not against the working directory.
+    char manifestFolder[MAX_SCAN_PATH];
+    if(!setPathToFolder(manifestFolder, manifestPath))
+    {
+        fclose(manifestFile);
+        reportError("Error: The manifest path is too long");
+        return 0;
+    }
+    char* folderEnd = manifestFolder;
+    for(char* c = manifestFolder; *c; c++)
+    {
+        if(isPathSeparator(*c))
+        {
+            folderEnd = c + 1;
+        }
+    }
+    *folderEnd = 0;
+    
+    u32 groupCount = 0;
+    u32 lineNumber = 0;
+    char line[MAX_MANIFEST_LINE];
+    while(fgets(line, sizeof(line), manifestFile))
+    {
+        lineNumber++;
+        char* p = line;
+        while((*p == ' ') || (*p == '\t'))
+        {
+            p++;
+        }
+        if((*p == '#') || (*p == '\r') || (*p == '\n') || !*p)
+        {
+            continue;
+        }
+        
+        u32 length = (u32)strlen(p);
+        char* groupLine = PushArray(lineArena, length + 1, char);
+        memcpy(groupLine, p, length + 1);
+        AtlasGroup group = {};
+        if(!parseManifestLine(groupLine, &group))
+        {
+            fprintf(stderr, "Skipping manifest line %u\n", lineNumber);
+            continue;
+        }
+        
+        const char* folderPath = group.folderPath;
+        bool isAbsolute = isPathSeparator(folderPath[0]) || (folderPath[0] && (folderPath[1] == ':'));
+        if(!isAbsolute && manifestFolder[0])
+        {
+            char resolvedPath[MAX_SCAN_PATH];
+            if(!buildFolderPath(resolvedPath, manifestFolder, folderPath))
+            {
+                fprintf(stderr, "Skipping manifest line %u, the folder path is longer than %u characters\n", lineNumber, MAX_SCAN_PATH - 1);
+                continue;
+            }
+            u32 resolvedLength = (u32)strlen(resolvedPath);
+            char* resolvedCopy = PushArray(lineArena, resolvedLength + 1, char);
+            memcpy(resolvedCopy, resolvedPath, resolvedLength + 1);
+            group.folderPath = resolvedCopy;
+        }
+        *PushStruct(batchArena, AtlasGroup) = group;
+        groupCount++;
+    }
+    fclose(manifestFile);
+    
+    return groupCount;
+}
+
+static JOB_CALLBACK(doProbeGroupJob)
+{
+    AtlasGroup* group = (AtlasGroup *)data;
+    
+    group->atlasMetadata = makeTextureAtlasMetadata(group->folderPath, &group->files, 64, 64, globalOptions.atlasFormat, true, getScratchArena(threadIndex));
+    group->atlasMetadata.report.scanMicroseconds = group->scanMicroseconds;
+    group->cache = makeLRUList(group->atlasMetadata.textureCount);
+    destroyFileList(&group->files);
+}
+
+static JOB_CALLBACK(doPackGroupJob)
+{
+    AtlasGroup* group = (AtlasGroup *)data;
+    TextureAtlasMetadata* atlasMetadata = &group->atlasMetadata;
+    
+    u64 packStart = getMicroseconds();
+    group->textureAtlas = beginTextureAtlas(atlasMetadata, nullptr, threadIndex);
+    // The groups already keep every thread busy, the pack search of a group runs on this one.
+    packTextures(atlasMetadata, &group->cache, &group->textureAtlas, nullptr, threadIndex);
+    group->packEnd = getMicroseconds();
+    atlasMetadata->report.packMicroseconds = group->packEnd - packStart;
+    collectPlacedTextures(&group->cache, group->placedTextures, group->decodeStripes, group->decodeStripeCount);
+}
+
+// NOTE: Writes <name>.png and <name>Metadata.txt into the folder of the group, and the debug outputs that are on.
+static void writeAtlasGroup(AtlasGroup* group, u32 threadIndex)
+{
+    u64 writeStart = getMicroseconds();
+    char fileName[MAX_SCAN_PATH];
+    snprintf(fileName, sizeof(fileName), "%sMetadata.txt", group->name);
+    writeTextureAtlasMetadata(&group->atlasMetadata, &group->cache, fileName);
+    if(globalOptions.deterministic)
+    {
+        writeContentHash(&group->textureAtlas, &group->atlasMetadata, fileName);
+    }
+    snprintf(fileName, sizeof(fileName), "%s.png", group->name);
+    writeTextureAtlas(&group->textureAtlas, &group->atlasMetadata, group->cache.nodeCount, fileName);
+    group->atlasMetadata.report.writeMicroseconds = getMicroseconds() - writeStart;
+    
+    if(globalOptions.report)
+    {
+        snprintf(fileName, sizeof(fileName), "%sReport.json", group->name);
+        writeTextureAtlasReport(&group->textureAtlas, &group->atlasMetadata, &group->cache, fileName);
+    }
+    if(globalOptions.overlay)
+    {
+        snprintf(fileName, sizeof(fileName), "%sOverlay.png", group->name);
+        writeTextureAtlasOverlay(&group->textureAtlas, &group->atlasMetadata, &group->cache, fileName);
+    }
+    if(globalOptions.validate)
+    {
+        validateTexturePlacements(&group->textureAtlas, &group->atlasMetadata, &group->cache, getScratchArena(threadIndex));
+    }
+}
+
+static JOB_CALLBACK(doWriteGroupJob)
+{
+    AtlasGroup* group = (AtlasGroup *)data;
+    group->atlasMetadata.report.decodeMicroseconds = getMicroseconds() - group->packEnd;
+    writeAtlasGroup(group, threadIndex);
+}
+
+// NOTE: Packs every group of the manifest in one process. Each group is a chain of jobs in one graph:
+// probe the headers, pack, decode into the atlas in stripes, then encode and write. The chains don't
+// depend on each other, so one group can be encoding while another is still packing or decoding.
+static void runBatch(const char* manifestPath)
+{
+    MemoryStack batchArena = InitGrowableStackMemory();
+    MemoryStack lineArena = InitGrowableStackMemory();
+    u32 groupCount = readManifest(manifestPath, &batchArena, &lineArena);
+    AtlasGroup* groups = GetArrayElements(batchArena, AtlasGroup);
+    printf("Manifest has %u groups\n", groupCount);
+    
+    // The directory walk already runs on every thread, the groups are scanned one after another.
+    for(u32 i = 0; i < groupCount; i++)
+    {
+        AtlasGroup* group = &groups[i];
+        printf("Group %s: %s\n", group->name, group->folderPath);
+        u64 scanStart = getMicroseconds();
+        group->files = scanTextureFiles(group->folderPath, &group->scan);
+        group->scanMicroseconds = getMicroseconds() - scanStart;
+    }
+    
+    MemoryStack workArena = InitGrowableStackMemory();
+    JobGraph* graph = makeJobGraph();
+    for(u32 i = 0; i < groupCount; i++)
+    {
+        AtlasGroup* group = &groups[i];
+        group->placedTextures = PushArray(&workArena, group->files.fileCount, Texture*);
+        group->decodeStripeCount = globalWorkQueue.threadCount;
+        group->decodeStripes = PushArray(&workArena, group->decodeStripeCount, DecodeIntoAtlasWork);
+        
+        Job* probeJob = addJob(graph, doProbeGroupJob, group);
+        Job* packJob = addJob(graph, doPackGroupJob, group);
+        Job* writeJob = addJob(graph, doWriteGroupJob, group);
+        addJobDependency(graph, probeJob, packJob);
+        for(u32 stripeIndex = 0; stripeIndex < group->decodeStripeCount; stripeIndex++)
+        {
+            DecodeIntoAtlasWork* stripe = &group->decodeStripes[stripeIndex];
+            stripe->textureAtlas = &group->textureAtlas;
+            stripe->atlasMetadata = &group->atlasMetadata;
+            stripe->textures = group->placedTextures;
+            stripe->textureCount = 0;
+            stripe->firstTexture = stripeIndex;
+            stripe->stride = group->decodeStripeCount;
+            
+            Job* decodeJob = addJob(graph, doDecodeIntoAtlasJob, stripe);
+            addJobDependency(graph, packJob, decodeJob);
+            addJobDependency(graph, decodeJob, writeJob);
+        }
+    }
+    
+    u64 runStart = getMicroseconds();
+    runJobGraph(graph, &globalWorkQueue);
+    if(globalOptions.stats)
+    {
+        printf("Probing, packing, decoding and writing %u groups took %llu us\n", groupCount, getMicroseconds() - runStart);
+    }
+    destroyJobGraph(graph);
+    FreeMemoryStack(&workArena);
+    
+    for(u32 i = 0; i < groupCount; i++)
+    {
+        AtlasGroup* group = &groups[i];
+        FreeMemoryStack(&group->cache.arena);
+        destroyTextureAtlasMetadata(&group->atlasMetadata);
+    }
+    FreeMemoryStack(&lineArena);
+    FreeMemoryStack(&batchArena);
+}
+
+// NOTE: Written next to the textures by a single folder run, their own change notifications aren't edits.
+static const char* atlasOutputNames[] = {"atlas.png", "atlasMetadata.txt", "atlasReport.json", "atlasOverlay.png"};
+
+// NOTE: The metadata only needs the placements, it can be written while the atlas pixels are still being filled in.
+static void writeTextureAtlasPlacements(TextureAtlasMetadata* atlasMetadata, LRUCache* cache)
+{
+    u64 writeStart = getMicroseconds();
+    writeTextureAtlasMetadata(atlasMetadata, cache, "atlasMetadata.txt");
+    atlasMetadata->report.writeMicroseconds = getMicroseconds() - writeStart;
+}
+
+// NOTE: Everything that reads the atlas pixels, once the placements have been written.
+static void writeTextureAtlasImage(Texture* textureAtlas, TextureAtlasMetadata* atlasMetadata, LRUCache* cache, u32 threadIndex)
+{
+    u64 writeStart = getMicroseconds();
+    if(globalOptions.deterministic)
+    {
+        writeContentHash(textureAtlas, atlasMetadata, "atlasMetadata.txt");
+    }
+    
+    writeTextureAtlas(textureAtlas, atlasMetadata, cache->nodeCount, "atlas.png");
+    atlasMetadata->report.writeMicroseconds += getMicroseconds() - writeStart;
+    if(globalOptions.report)
+    {
+        writeTextureAtlasReport(textureAtlas, atlasMetadata, cache, "atlasReport.json");
+    }
+    if(globalOptions.overlay)
+    {
+        writeTextureAtlasOverlay(textureAtlas, atlasMetadata, cache, "atlasOverlay.png");
+    }
+    if(globalOptions.validate)
+    {
+        validateTexturePlacements(textureAtlas, atlasMetadata, cache, getScratchArena(threadIndex));
+    }
+}
+
+static void writeTextureAtlasOutputs(Texture* textureAtlas, TextureAtlasMetadata* atlasMetadata, LRUCache* cache)
+{
+    writeTextureAtlasPlacements(atlasMetadata, cache);
+    writeTextureAtlasImage(textureAtlas, atlasMetadata, cache, 0);
+}
+
+//
+// single atlas job graph
+//
+
+// NOTE: Once its textures are loaded and the atlas is sized, a single atlas run is one job graph:
+//
+//     premultiply stripes ---------------------------+
+//                                                    v
+//     pack search stripes --> pack --+--> blit bands, or decode stripes --> finish --> write image
+//                                    +--> write metadata -------------------------------^
+//
+// In a -concurrent run insert stripes place and blit in place of the pack and the bands, after the premultiply.
+// The distance fields change the texture sizes and the -fit search decides the atlas size the graph is built for,
+// so both still run on the work queue before it.
+struct AtlasJobs
+{
+    TextureAtlasMetadata* atlasMetadata;
+    LRUCache* cache;
+    Texture* textureAtlas;
+    MemoryStack workArena;
+    u64 graphStart;
+    u64 packEnd;
+    u64 packAllocations;
+    bool isPremultiplying;
+    
+    PackAttempt* attempts;
+    u32 attemptCount;
+    BlitBandWork* bands;
+    u32 bandCount;
+    Texture** placedTextures;
+    DecodeIntoAtlasWork* decodeStripes;
+    u32 decodeStripeCount;
+    ConcurrentAtlas concurrentAtlas;
+};
+
+static JOB_CALLBACK(doFinishPremultiplyJob)
+{
+    AtlasJobs* jobs = (AtlasJobs *)data;
+    if(!jobs->isPremultiplying)
+    {
+        return;
+    }
+    
+    TextureAtlasMetadata* atlasMetadata = jobs->atlasMetadata;
+    atlasMetadata->report.premultiplyMicroseconds = getMicroseconds() - jobs->graphStart;
+    if(globalOptions.stats)
+    {
+        printf("Premultiplying %u textures took %llu us\n", atlasMetadata->textureArena.elementCount, atlasMetadata->report.premultiplyMicroseconds);
+    }
+}
+
+// NOTE: Picks the best search attempt, packs, then hands the blit bands or the decode stripes their textures.
+static JOB_CALLBACK(doPackAtlasJob)
+{
+    AtlasJobs* jobs = (AtlasJobs *)data;
+    PackAttempt attempt = {};
+    if(jobs->attemptCount)
+    {
+        attempt = pickBestPackAttempt(jobs->attempts, jobs->attemptCount);
+    }
+    packTexturesAsAttempt(jobs->atlasMetadata, jobs->cache, jobs->textureAtlas, &attempt, jobs->graphStart, threadIndex);
+    jobs->cache->atlasWidth = jobs->textureAtlas->width;
+    jobs->cache->atlasHeight = jobs->textureAtlas->height;
+    jobs->packEnd = getMicroseconds();
+    
+    if(globalOptions.twoPhase)
+    {
+        collectPlacedTextures(jobs->cache, jobs->placedTextures, jobs->decodeStripes, jobs->decodeStripeCount);
+    }
+    else
+    {
+        binTexturesIntoBands(jobs->textureAtlas, jobs->cache, jobs->bands, jobs->bandCount, &jobs->workArena);
+    }
+}
+
+static JOB_CALLBACK(doEndConcurrentAtlasJob)
+{
+    AtlasJobs* jobs = (AtlasJobs *)data;
+    endConcurrentAtlas(&jobs->concurrentAtlas, jobs->cache);
+    jobs->packEnd = getMicroseconds();
+    
+    // Two phase inserts only placed the textures, the decode stripes fill them in.
+    if(globalOptions.twoPhase)
+    {
+        collectPlacedTextures(jobs->cache, jobs->placedTextures, jobs->decodeStripes, jobs->decodeStripeCount);
+    }
+}
+
+static JOB_CALLBACK(doFinishAtlasJob)
+{
+    AtlasJobs* jobs = (AtlasJobs *)data;
+    TextureAtlasMetadata* atlasMetadata = jobs->atlasMetadata;
+    u64 finishTime = getMicroseconds();
+    if(globalOptions.twoPhase)
+    {
+        atlasMetadata->report.packMicroseconds = jobs->packEnd - jobs->graphStart;
+        atlasMetadata->report.decodeMicroseconds = finishTime - jobs->packEnd;
+    }
+    else
+    {
+        atlasMetadata->report.packMicroseconds = finishTime - jobs->graphStart;
+    }
+    
+    if(globalOptions.stats)
+    {
+        printf("Packing took %llu us with %llu allocations\n", atlasMetadata->report.packMicroseconds, globalAllocationCount - jobs->packAllocations);
+        if(globalOptions.twoPhase)
+        {
+            printf("Decoding into the atlas took %llu us\n", atlasMetadata->report.decodeMicroseconds);
+        }
+    }
+}
+
+static JOB_CALLBACK(doWriteAtlasPlacementsJob)
+{
+    AtlasJobs* jobs = (AtlasJobs *)data;
+    writeTextureAtlasPlacements(jobs->atlasMetadata, jobs->cache);
+}
+
+static JOB_CALLBACK(doWriteAtlasImageJob)
+{
+    AtlasJobs* jobs = (AtlasJobs *)data;
+    writeTextureAtlasImage(jobs->textureAtlas, jobs->atlasMetadata, jobs->cache, threadIndex);
+}
+
+// NOTE: The textures are premultiplied in the graph when premultiply is set, a two phase run does it as it decodes
+// instead. The outputs of a single folder run are written in the graph when writeOutputs is set.
+static Texture generateTextureAtlas(TextureAtlasMetadata* atlasMetadata, LRUCache* cache, bool premultiply, bool writeOutputs)
+{
+    Texture result = beginTextureAtlas(atlasMetadata, &globalWorkQueue, 0);
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    u32 textureCount = atlasMetadata->textureArena.elementCount;
+    u32 threadCount = globalWorkQueue.threadCount;
+    
+    AtlasJobs jobs = {};
+    jobs.atlasMetadata = atlasMetadata;
+    jobs.cache = cache;
+    jobs.textureAtlas = &result;
+    jobs.workArena = InitGrowableStackMemory();
+    JobGraph* graph = makeJobGraph();
+    
+    // Joins the premultiply stripes, the pixels are only read once it has run. The stripes get their own copy of
+    // the texture list, the pack reorders the texture array while they run.
+    Job* premultiplyJob = addJob(graph, doFinishPremultiplyJob, &jobs);
+    jobs.isPremultiplying = premultiply;
+    if(premultiply)
+    {
+        Texture* premultiplyTextures = PushArray(&jobs.workArena, textureCount, Texture);
+        memcpy(premultiplyTextures, textures, textureCount*sizeof(Texture));
+        u32 workCount = min(textureCount, threadCount*4);
+        PremultiplyWork* works = PushArray(&jobs.workArena, workCount, PremultiplyWork);
+        for(u32 workIndex = 0; workIndex < workCount; workIndex++)
+        {
+            PremultiplyWork* work = &works[workIndex];
+            work->textures = premultiplyTextures;
+            work->textureCount = textureCount;
+            work->firstTexture = workIndex;
+            work->stride = workCount;
+            work->format = atlasMetadata->format;
+            addJobDependency(graph, addJob(graph, doPremultiplyJob, work), premultiplyJob);
+        }
+    }
+    
+    Job* packJob;
+    if(globalOptions.concurrentInsert)
+    {
+        // Place and blit the textures from all the threads at once.
+        beginConcurrentAtlas(&jobs.concurrentAtlas, textures, textureCount, &result, threadCount);
+        packJob = addJob(graph, doEndConcurrentAtlasJob, &jobs);
+        for(u32 workIndex = 0; workIndex < jobs.concurrentAtlas.workCount; workIndex++)
+        {
+            Job* insertJob = addJob(graph, doConcurrentInsertJob, &jobs.concurrentAtlas.works[workIndex]);
+            addJobDependency(graph, premultiplyJob, insertJob);
+            addJobDependency(graph, insertJob, packJob);
+        }
+    }
+    else
+    {
+        packJob = addJob(graph, doPackAtlasJob, &jobs);
+        if(isPackSearched())
+        {
+            // The search stripes only read the textures, the pack reorders them once they are all done.
+            bool isFixedSize = globalOptions.fitPowerOfTwo || globalOptions.fitMultiple;
+            jobs.attempts = makePackAttempts(&jobs.workArena, isFixedSize, &jobs.attemptCount);
+            u32 workCount = min(jobs.attemptCount, threadCount);
+            PackSearchWork* works = PushArray(&jobs.workArena, workCount, PackSearchWork);
+            for(u32 workIndex = 0; workIndex < workCount; workIndex++)
+            {
+                PackSearchWork* work = &works[workIndex];
+                *work = {jobs.attempts, jobs.attemptCount, workIndex, workCount, textures, textureCount, result.width, result.height};
+                addJobDependency(graph, addJob(graph, doPackSearchJob, work), packJob);
+            }
+        }
+    }
+    
+    Job* finishJob = addJob(graph, doFinishAtlasJob, &jobs);
+    addJobDependency(graph, premultiplyJob, finishJob);
+    addJobDependency(graph, packJob, finishJob);
+    if(globalOptions.twoPhase)
+    {
+        jobs.placedTextures = PushArray(&jobs.workArena, textureCount, Texture*);
+        jobs.decodeStripeCount = threadCount;
+        jobs.decodeStripes = PushArray(&jobs.workArena, jobs.decodeStripeCount, DecodeIntoAtlasWork);
+        for(u32 stripeIndex = 0; stripeIndex < jobs.decodeStripeCount; stripeIndex++)
+        {
+            DecodeIntoAtlasWork* stripe = &jobs.decodeStripes[stripeIndex];
+            stripe->textureAtlas = &result;
+            stripe->atlasMetadata = atlasMetadata;
+            stripe->textures = jobs.placedTextures;
+            stripe->textureCount = 0;
+            stripe->firstTexture = stripeIndex;
+            stripe->stride = jobs.decodeStripeCount;
+            
+            Job* decodeJob = addJob(graph, doDecodeIntoAtlasJob, stripe);
+            addJobDependency(graph, packJob, decodeJob);
+            addJobDependency(graph, decodeJob, finishJob);
+        }
+    }
+    else if(!globalOptions.concurrentInsert)
+    {
+        jobs.bandCount = getBlitBandCount(&result, threadCount);
+        jobs.bands = PushArray(&jobs.workArena, jobs.bandCount, BlitBandWork);
+        for(u32 band = 0; band < jobs.bandCount; band++)
+        {
+            Job* blitJob = addJob(graph, doBlitBandJob, &jobs.bands[band]);
+            addJobDependency(graph, packJob, blitJob);
+            addJobDependency(graph, premultiplyJob, blitJob);
+            addJobDependency(graph, blitJob, finishJob);
+        }
+    }
+    
+    if(writeOutputs)
+    {
+        Job* placementsJob = addJob(graph, doWriteAtlasPlacementsJob, &jobs);
+        Job* imageJob = addJob(graph, doWriteAtlasImageJob, &jobs);
+        addJobDependency(graph, packJob, placementsJob);
+        addJobDependency(graph, placementsJob, imageJob);
+        addJobDependency(graph, finishJob, imageJob);
+    }
+    
+    jobs.graphStart = getMicroseconds();
+    jobs.packAllocations = globalAllocationCount;
+    runJobGraph(graph, &globalWorkQueue);
+    destroyJobGraph(graph);
+    FreeMemoryStack(&jobs.workArena);
+    
+    return result;
+}
+
+static bool isAtlasOutputName(const char* relativePath)
+{
+    for(u32 i = 0; i < ArrayCount(atlasOutputNames); i++)
+    {
+        if(isSameScanPath(relativePath, atlasOutputNames[i]))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// NOTE: Index of the texture loaded from the path, or the texture count when none was.
+static u32 findTextureByPath(TextureAtlasMetadata* atlasMetadata, const char* relativePath)
+{
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    u32 textureCount = atlasMetadata->textureArena.elementCount;
+    u32 result = 0;
+    for(; result < textureCount; result++)
+    {
+        if(isSameScanPath(getString(&atlasMetadata->fileNames, textures[result].fileNameOffset), relativePath))
+        {
+            break;
+        }
+    }
+    
+    return result;
+}
+
+// NOTE: Files or folders that appeared, went away or were renamed change which textures there are when
+// the scan would pick them up, or when they are folders holding or about to hold textures.
+static bool isTextureSetChange(TextureAtlasMetadata* atlasMetadata, const char* relativePath, DWORD action)
+{
+    if(isScannedPath(&globalOptions.scan, relativePath))
+    {
+        return true;
+    }
+    if(!globalOptions.scan.recursive)
+    {
+        return false;
+    }
+    
+    if((action == FILE_ACTION_ADDED) || (action == FILE_ACTION_RENAMED_NEW_NAME))
+    {
+        char path[MAX_SCAN_PATH];
+        buildFolderPath(path, atlasMetadata->folderPath, relativePath);
+        DWORD attributes = GetFileAttributesA(path);
+        return (attributes != INVALID_FILE_ATTRIBUTES) && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+    
+    // A folder that is gone can't be asked, the textures under it tell.
+    u32 length = (u32)strlen(relativePath);
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    for(u32 i = 0; i < atlasMetadata->textureArena.elementCount; i++)
+    {
+        const char* name = getString(&atlasMetadata->fileNames, textures[i].fileNameOffset);
+        char prefix[MAX_SCAN_PATH];
+        snprintf(prefix, sizeof(prefix), "%.*s", length, name);
+        if(isPathSeparator(name[min(length, (u32)strlen(name))]) && isSameScanPath(prefix, relativePath))
+        {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// NOTE: Decodes a changed texture again. Its pixels are overwritten when the size stayed the same,
+// otherwise they go to new memory from the pixel arena and isResized tells the caller to repack.
+static bool reloadTexture(TextureAtlasMetadata* atlasMetadata, Texture* texture, bool* isResized, MemoryStack* scratchArena)
+{
+    char path[MAX_SCAN_PATH];
+    buildTexturePath(path, atlasMetadata, texture);
+    MappedFile file;
+    if(!openMappedFile(path, &file))
+    {
+        return false;
+    }
+    
+    threadScratchArena = scratchArena;
+    TemporaryMemory decodeMemory = BeginTemporaryMemory(scratchArena);
+    s32 width;
+    s32 height;
+    s32 channels;
+    byte* decoded = decodeImageForFormat(&file, &width, &height, &channels, atlasMetadata->format);
+    closeMappedFile(&file);
+    if(decoded)
+    {
+        PixelConversion conversion = makePixelConversion(channels, atlasMetadata->format);
+        *isResized = (width != texture->width) || (height != texture->height);
+        if(*isResized)
+        {
+            texture->memory = PushSizeAligned(&atlasMetadata->pixelArena, (size_t)width*height*conversion.destPixelBytes, byte, 16);
+            texture->width = (u16)width;
+            texture->height = (u16)height;
+        }
+        convertPixels(&conversion, decoded, (byte *)texture->memory, width*height);
+        if(globalOptions.premultiply)
+        {
+            premultiplyPixelRows((byte *)texture->memory, width, height, width*texture->bpp, atlasMetadata->format, &globalPremultiplyTable);
+        }
+    }
+    EndTemporaryMemory(decodeMemory);
+    threadScratchArena = nullptr;
+    
+    return decoded != nullptr;
+}
+
+#define WATCH_BUFFER_SIZE KILOBYTES(64)
+
+// NOTE: Keeps the decoded textures, the node tree and the atlas of the first run and waits for changes to the
+// folder, ReadDirectoryChangesW queues them up between calls. An edited texture that kept its size is decoded
+// straight over its old pixels and blitted into its old rect. A changed size repacks the resident textures,
+// still only decoding the edited ones. Textures added, removed or renamed need a rescan, true asks for a cold run.
+// The atlas memory marker is moved along when a repack allocates a new atlas.
+static bool watchTextureAtlas(TextureAtlasMetadata* atlasMetadata, LRUCache* cache, Texture* textureAtlas, TemporaryMemory* atlasMemory)
+{
+    HANDLE directory = CreateFileA(atlasMetadata->folderPath, FILE_LIST_DIRECTORY, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, 0);
+    if(directory == INVALID_HANDLE_VALUE)
+    {
+        reportError("Error: Could not watch the texture folder");
+        return false;
+    }
+    
+    MemoryStack* scratchArena = getScratchArena(0);
+    TemporaryMemory watchMemory = BeginTemporaryMemory(scratchArena);
+    // The notifications are DWORD aligned.
+    DWORD* changeBuffer = PushArrayAligned(scratchArena, WATCH_BUFFER_SIZE / sizeof(DWORD), DWORD, sizeof(DWORD));
+    DWORD notifyFilter = FILE_NOTIFY_CHANGE_FILE_NAME|FILE_NOTIFY_CHANGE_DIR_NAME|FILE_NOTIFY_CHANGE_LAST_WRITE|FILE_NOTIFY_CHANGE_SIZE;
+    printf("Watching %s for changes, Ctrl+C stops\n", atlasMetadata->folderPath);
+    
+    bool isRestart = false;
+    while(!isRestart)
+    {
+        DWORD bytesReturned = 0;
+        if(!ReadDirectoryChangesW(directory, changeBuffer, WATCH_BUFFER_SIZE, globalOptions.scan.recursive, notifyFilter, &bytesReturned, 0, 0))
+        {
+            reportError("Error: Watching the texture folder failed");
+            break;
+        }
+        u64 changeStart = getMicroseconds();
+        
+        // Zero bytes means the changes overflowed the buffer, only a rescan is sure to see them all.
+        isRestart = (bytesReturned == 0);
+        Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+        u32 textureCount = atlasMetadata->textureArena.elementCount;
+        TemporaryMemory changeMemory = BeginTemporaryMemory(scratchArena);
+        bool* isChanged = PushArray(scratchArena, max(textureCount, 1u), bool);
+        memset(isChanged, 0, textureCount*sizeof(bool));
+        u32 changedCount = 0;
+        FILE_NOTIFY_INFORMATION* change = (FILE_NOTIFY_INFORMATION *)changeBuffer;
+        while(change && !isRestart)
+        {
+            // Editors save in several writes, every texture is decoded once per batch of notifications.
+            char relativePath[MAX_SCAN_PATH];
+            s32 length = WideCharToMultiByte(CP_UTF8, 0, change->FileName, change->FileNameLength / sizeof(WCHAR), relativePath, sizeof(relativePath) - 1, 0, 0);
+            relativePath[length] = 0;
+            if(!isAtlasOutputName(relativePath))
+            {
+                if(change->Action == FILE_ACTION_MODIFIED)
+                {
+                    u32 index = findTextureByPath(atlasMetadata, relativePath);
+                    if((index < textureCount) && !isChanged[index])
+                    {
+                        isChanged[index] = true;
+                        changedCount++;
+                    }
+                }
+                else
+                {
+                    isRestart = isTextureSetChange(atlasMetadata, relativePath, change->Action);
+                }
+            }
+            change = change->NextEntryOffset ? (FILE_NOTIFY_INFORMATION *)((byte *)change + change->NextEntryOffset) : nullptr;
+        }
+        
+        bool isRepack = false;
+        u32 updatedCount = 0;
+        for(u32 i = 0; (i < textureCount) && !isRestart; i++)
+        {
+            if(!isChanged[i])
+            {
+                continue;
+            }
+            
+            Texture* texture = &textures[i];
+            bool isResized = false;
+            if(!reloadTexture(atlasMetadata, texture, &isResized, scratchArena))
+            {
+                // Most likely still being written, the write that finishes it comes with its own notification.
+                printf("Could not decode %s yet\n", getString(&atlasMetadata->fileNames, texture->fileNameOffset));
+                continue;
+            }
+            isRepack |= isResized;
+            if(!isResized && findInLRUHashTable(&cache->hashLookup, texture))
+            {
+                blitTextureIntoAtlas(textureAtlas, texture);
+                updatedCount++;
+            }
+        }
+        EndTemporaryMemory(changeMemory);
+        
+        if(isRepack && !isRestart)
+        {
+            // The old atlas and nodes are dropped, the textures are all still decoded.
+            // The nodes expect zeroed memory, so their arena is released instead of rewound.
+            EndTemporaryMemory(*atlasMemory);
+            *atlasMemory = BeginTemporaryMemory(&atlasMetadata->textureArena);
+            FreeMemoryStack(&atlasMetadata->textureNodeArena);
+            atlasMetadata->textureNodeArena = InitGrowableStackMemory();
+            clearLRUCache(cache);
+            *textureAtlas = generateTextureAtlas(atlasMetadata, cache, false, false);
+        }
+        if((isRepack || updatedCount) && !isRestart)
+        {
+            writeTextureAtlasOutputs(textureAtlas, atlasMetadata, cache);
+            printf("%s %u changed textures in %llu us\n", isRepack ? "Repacked" : "Updated", changedCount, getMicroseconds() - changeStart);
+        }
+    }
+    
+    EndTemporaryMemory(watchMemory);
+    CloseHandle(directory);
+    
+    return isRestart;
+}
+
+//
+// server mode
+//
+
+// NOTE: Stays resident and packs atlases on request over a named pipe, one client at a time. Only the user running
+// the server can connect, and only from this machine. Every request is one line, tokens with spaces can be
+// quoted like in a manifest:
+//
+//     pack NAME FOLDER [scan options]     packs the folder like a manifest group, writes NAME.png and NAMEMetadata.txt
+//     rects NAME WxH WxH ...              only places the rects, nothing is decoded or written
+//     quit                                stops the server
+//
+// The reply is 'ok WIDTH HEIGHT PLACED COUNT', the output paths of a pack, one 'X Y W H NAME' line per texture,
+// X and Y -1 when it didn't fit, and 'end'. A request that fails gets 'error MESSAGE' and 'end'.
+// Decoded textures are kept between requests, keyed by their full path and last write time, so a texture
+// shared by several atlases or packed again unchanged is decoded only once. The ones missing are decoded on all the threads.
+
+#define SERVE_MAX_REQUEST KILOBYTES(64)
+#define SERVE_PIPE_BUFFER_SIZE KILOBYTES(64)
+#define TEXTURE_CACHE_EMPTY_SLOT 0xffffffff
+
+struct CachedTexture
+{
+    u32 pathOffset;     // NOTE: into the path arena of the cache
+    u64 lastWriteTime;
+    byte* pixels;       // NOTE: in the atlas format, premultiplied when that is on
+    u16 width;
+    u16 height;
+    u32 bpp;
+};
+
+struct TextureCache
+{
+    MemoryStack pathArena;
+    MemoryStack entryArena;
+    MemoryStack slotArena;
+    MemoryStack pixelArena;
+    u32* slots;         // NOTE: indices into the entries, linear probing
+    u32 slotCapacity;   // NOTE: always a power of two
+    u64 staleBytes;     // NOTE: pixels of entries that were decoded again since, compacted away once they are half
+    u32 hitCount;       // NOTE: of the current request
+    u32 missCount;
+};
+
+static TextureCache makeTextureCache()
+{
+    TextureCache result = {};
+    result.pathArena = InitGrowableStackMemory();
+    result.entryArena = InitGrowableStackMemory();
+    result.slotArena = InitGrowableStackMemory();
+    result.pixelArena = InitGrowableStackMemory(GIGABYTES(16));
+    result.slotCapacity = 256;
+    result.slots = PushArray(&result.slotArena, result.slotCapacity, u32);
+    memset(result.slots, 0xff, result.slotCapacity*sizeof(u32));
+    
+    return result;
+}
+
+static void destroyTextureCache(TextureCache* textureCache)
+{
+    FreeMemoryStack(&textureCache->pathArena);
+    FreeMemoryStack(&textureCache->entryArena);
+    FreeMemoryStack(&textureCache->slotArena);
+    FreeMemoryStack(&textureCache->pixelArena);
+}
+
+static const char* getCachedTexturePath(TextureCache* textureCache, const CachedTexture* entry)
+{
+    return (const char *)textureCache->pathArena.base + entry->pathOffset;
+}
+
+static u32* findTextureCacheSlot(TextureCache* textureCache, const char* path)
+{
+    CachedTexture* entries = GetArrayElements(textureCache->entryArena, CachedTexture);
+    u32 mask = textureCache->slotCapacity - 1;
+    u32 index = hashString(path) & mask;
+    for(;;)
+    {
+        u32* slot = &textureCache->slots[index];
+        if((*slot == TEXTURE_CACHE_EMPTY_SLOT) || (strcmp(getCachedTexturePath(textureCache, &entries[*slot]), path) == 0))
+        {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void growTextureCache(TextureCache* textureCache)
+{
+    // Like the string table, the old slots stay behind in the slot arena.
+    textureCache->slotCapacity *= 2;
+    textureCache->slots = PushArray(&textureCache->slotArena, textureCache->slotCapacity, u32);
+    memset(textureCache->slots, 0xff, textureCache->slotCapacity*sizeof(u32));
+    CachedTexture* entries = GetArrayElements(textureCache->entryArena, CachedTexture);
+    for(u32 i = 0; i < textureCache->entryArena.elementCount; i++)
+    {
+        *findTextureCacheSlot(textureCache, getCachedTexturePath(textureCache, &entries[i])) = i;
+    }
+}
+
+// NOTE: Moves the pixels of every entry into a fresh arena, which drops the ones replaced since.
+static void compactTextureCache(TextureCache* textureCache)
+{
+    MemoryStack pixelArena = InitGrowableStackMemory(GIGABYTES(16));
+    CachedTexture* entries = GetArrayElements(textureCache->entryArena, CachedTexture);
+    for(u32 i = 0; i < textureCache->entryArena.elementCount; i++)
+    {
+        CachedTexture* entry = &entries[i];
+        size_t size = (size_t)entry->width*entry->height*entry->bpp;
+        byte* pixels = PushSizeAligned(&pixelArena, size, byte, 16);
+        memcpy(pixels, entry->pixels, size);
+        entry->pixels = pixels;
+    }
+    printf("Compacting the texture cache dropped %llu bytes\n", textureCache->staleBytes);
+    FreeMemoryStack(&textureCache->pixelArena);
+    textureCache->pixelArena = pixelArena;
+    textureCache->staleBytes = 0;
+}
+
+// NOTE: Finds the texture at path in the cache. Null when it isn't there or the file changed since it was decoded,
+// lastWriteTime is then what to decode it under. Returns false when the file can't be read at all.
+static bool findCachedTexture(TextureCache* textureCache, const char* path, CachedTexture** entry, u64* lastWriteTime)
+{
+    *entry = nullptr;
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if(!GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+    {
+        return false;
+    }
+    *lastWriteTime = ((u64)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    
+    u32 slot = *findTextureCacheSlot(textureCache, path);
+    if(slot != TEXTURE_CACHE_EMPTY_SLOT)
+    {
+        CachedTexture* cached = GetArrayElements(textureCache->entryArena, CachedTexture) + slot;
+        if(cached->lastWriteTime == *lastWriteTime)
+        {
+            textureCache->hitCount++;
+            *entry = cached;
+        }
+    }
+    
+    return true;
+}
+
+// NOTE: A texture of the request that isn't cached or changed since. The main thread probes its size and reserves
+// its pixels in the cache, then the worker threads decode right into them.
+struct TextureCacheMiss
+{
+    const char* path;
+    u32 fileIndex;
+    u64 lastWriteTime;
+    byte* pixels;
+    u16 width;
+    u16 height;
+    bool isDecoded;
+};
+
+struct DecodeCacheMissesWork
+{
+    TextureCacheMiss* misses;
+    u32 missCount;
+    u32 firstMiss;
+    u32 stride;
+    AtlasFormat format;
+};
+
+// NOTE: Only the IHDR chunk is read, the pixels are reserved in the atlas format whatever the file has.
+static bool probeTextureCacheMiss(TextureCache* textureCache, TextureCacheMiss* miss, AtlasFormat format)
+{
+    MappedFile file;
+    if(!openMappedFile(miss->path, &file))
+    {
+        return false;
+    }
+    s32 width;
+    s32 height;
+    s32 channels;
+    bool isValid = stbi_info_from_memory((stbi_uc *)file.memory, file.size, &width, &height, &channels) != 0;
+    closeMappedFile(&file);
+    if(isValid)
+    {
+        miss->width = (u16)width;
+        miss->height = (u16)height;
+        miss->pixels = PushSizeAligned(&textureCache->pixelArena, (size_t)width*height*getAtlasFormatBytesPerPixel(format), byte, 16);
+    }
+    
+    return isValid;
+}
+
+static WORK_QUEUE_CALLBACK(doDecodeCacheMissesWork)
+{
+    DecodeCacheMissesWork* work = (DecodeCacheMissesWork *)data;
+    threadScratchArena = getScratchArena(threadIndex);
+    
+    for(u32 i = work->firstMiss; i < work->missCount; i += work->stride)
+    {
+        TextureCacheMiss* miss = &work->misses[i];
+        TemporaryMemory decodeMemory = BeginTemporaryMemory(threadScratchArena);
+        MappedFile file;
+        if(openMappedFile(miss->path, &file))
+        {
+            s32 width;
+            s32 height;
+            s32 channels;
+            byte* decoded = decodeImageForFormat(&file, &width, &height, &channels, work->format);
+            closeMappedFile(&file);
+            // The file may have been written again since the probe.
+            if(decoded && (width == miss->width) && (height == miss->height))
+            {
+                PixelConversion conversion = makePixelConversion(channels, work->format);
+                convertPixels(&conversion, decoded, miss->pixels, width*height);
+                if(globalOptions.premultiply)
+                {
+                    premultiplyPixelRows(miss->pixels, width, height, width*conversion.destPixelBytes, work->format, &globalPremultiplyTable);
+                }
+                miss->isDecoded = true;
+            }
+        }
+        EndTemporaryMemory(decodeMemory);
+    }
+    
+    threadScratchArena = nullptr;
+}
+
+// NOTE: Adds the decoded miss to the cache, or replaces the entry decoded from an older version of the file.
+static CachedTexture* insertCachedTexture(TextureCache* textureCache, TextureCacheMiss* miss, AtlasFormat format)
+{
+    if((textureCache->entryArena.elementCount + 1)*2 > textureCache->slotCapacity)
+    {
+        growTextureCache(textureCache);
+    }
+    u32* slot = findTextureCacheSlot(textureCache, miss->path);
+    CachedTexture* entry = nullptr;
+    if(*slot != TEXTURE_CACHE_EMPTY_SLOT)
+    {
+        entry = GetArrayElements(textureCache->entryArena, CachedTexture) + *slot;
+        textureCache->staleBytes += (size_t)entry->width*entry->height*entry->bpp;
+    }
+    else
+    {
+        u32 length = (u32)strlen(miss->path);
+        char* pathCopy = PushArray(&textureCache->pathArena, length + 1, char);
+        memcpy(pathCopy, miss->path, length + 1);
+        *slot = textureCache->entryArena.elementCount;
+        entry = PushStruct(&textureCache->entryArena, CachedTexture);
+        entry->pathOffset = (u32)(pathCopy - (char *)textureCache->pathArena.base);
+    }
+    entry->lastWriteTime = miss->lastWriteTime;
+    entry->width = miss->width;
+    entry->height = miss->height;
+    entry->bpp = getAtlasFormatBytesPerPixel(format);
+    entry->pixels = miss->pixels;
+    textureCache->missCount++;
+    
+    return entry;
+}
+
+// NOTE: Like makeTextureAtlasMetadata, but the pixels are borrowed from the cache and nothing is loaded yet.
+static TextureAtlasMetadata makeServedTextureAtlasMetadata(const char* folderPath, u32 textureCount, u32 width, u32 height, AtlasFormat format)
+{
+    TextureAtlasMetadata result = {};
+    result.folderPath = folderPath;
+    result.bpp = getAtlasFormatBytesPerPixel(format);
+    result.maxSize = width*height*result.bpp;
+    result.textureArena = InitGrowableStackMemory(max(DEFAULT_STACK_RESERVE, textureCount*sizeof(Texture) + result.maxSize + 64));
+    result.textureNodeArena = InitGrowableStackMemory();
+    result.fileNames = makeStringTable(textureCount);
+    result.textureCount = textureCount;
+    result.width = width;
+    result.height = height;
+    result.format = format;
+    
+    return result;
+}
+
+// NOTE: Appends printf style text to the reply, which is sent as a whole once the request is done.
+static void appendReply(MemoryStack* replyArena, const char* format, ...)
+{
+    char text[MAX_SCAN_PATH + 128];
+    va_list args;
+    va_start(args, format);
+    s32 length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if(length < 0)
+    {
+        return;
+    }
+    length = min(length, (s32)sizeof(text) - 1);
+    memcpy(PushArray(replyArena, length, char), text, length);
+}
+
+// NOTE: One 'X Y W H NAME' line per texture, in packing order.
+static void appendReplyTextures(MemoryStack* replyArena, TextureAtlasMetadata* atlasMetadata, LRUCache* cache)
+{
+    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
+    for(u32 i = 0; i < atlasMetadata->textureCount; i++)
+    {
+        Texture* texture = &textures[i];
+        bool isPlaced = findInLRUHashTable(&cache->hashLookup, texture) != nullptr;
+        s32 x = isPlaced ? texture->x : -1;
+        s32 y = isPlaced ? texture->y : -1;
+        appendReply(replyArena, "%d %d %u %u %s\n", x, y, texture->width, texture->height, getString(&atlasMetadata->fileNames, texture->fileNameOffset));
+    }
+}
+
+static void servePackRequest(char* request, TextureCache* textureCache, MemoryStack* replyArena)
+{
+    AtlasGroup group = {};
+    if(!parseManifestLine(request, &group))
+    {
+        appendReply(replyArena, "error expected pack NAME FOLDER [scan options]\n");
+        return;
+    }
+    // The same atlas is usually packed again into the same folder, its last images are not textures.
+    char atlasPattern[MAX_SCAN_PATH];
+    char overlayPattern[MAX_SCAN_PATH];
+    snprintf(atlasPattern, sizeof(atlasPattern), "%s.png", group.name);
+    snprintf(overlayPattern, sizeof(overlayPattern), "%sOverlay.png", group.name);
+    if(group.scan.excludeCount + 2 > MAX_SCAN_PATTERNS)
+    {
+        appendReply(replyArena, "error at most %u exclude patterns\n", MAX_SCAN_PATTERNS - 2);
+        return;
+    }
+    group.scan.excludePatterns[group.scan.excludeCount++] = atlasPattern;
+    group.scan.excludePatterns[group.scan.excludeCount++] = overlayPattern;
+    FileList files = scanFiles(group.folderPath, &group.scan, &globalWorkQueue);
+    if(files.fileCount == 0)
+    {
+        appendReply(replyArena, "error no textures found in %s\n", group.folderPath);
+        destroyFileList(&files);
+        return;
+    }
+    
+    // Compacted before this request borrows any pixels.
+    if(textureCache->staleBytes*2 > textureCache->pixelArena.bytes_used)
+    {
+        compactTextureCache(textureCache);
+    }
+    textureCache->hitCount = 0;
+    textureCache->missCount = 0;
+    
+    u64 loadStart = getMicroseconds();
+    TextureAtlasMetadata* atlasMetadata = &group.atlasMetadata;
+    *atlasMetadata = makeServedTextureAtlasMetadata(group.folderPath, files.fileCount, 64, 64, globalOptions.atlasFormat);
+    MemoryStack* scratchArena = getScratchArena(0);
+    TemporaryMemory requestMemory = BeginTemporaryMemory(scratchArena);
+    CachedTexture** entries = PushArray(scratchArena, files.fileCount, CachedTexture*);
+    TextureCacheMiss* misses = PushArray(scratchArena, files.fileCount, TextureCacheMiss);
+    u32 missCount = 0;
+    for(u32 i = 0; i < files.fileCount; i++)
+    {
+        char path[MAX_SCAN_PATH];
+        buildFolderPath(path, group.folderPath, getFileListPath(&files, i));
+        u64 lastWriteTime;
+        if(findCachedTexture(textureCache, path, &entries[i], &lastWriteTime) && !entries[i])
         {
-            u32 texturePitch = width*bpp;
-            byte* source = (byte *)texture->memory;
-            for(u32 j = 0; j < height; j++)
+            u32 length = (u32)strlen(path);
+            char* pathCopy = PushArray(scratchArena, length + 1, char);
+            memcpy(pathCopy, path, length + 1);
+            TextureCacheMiss* miss = &misses[missCount];
+            *miss = {};
+            miss->path = pathCopy;
+            miss->fileIndex = i;
+            miss->lastWriteTime = lastWriteTime;
+            if(probeTextureCacheMiss(textureCache, miss, atlasMetadata->format))
             {
-                memcpy(dest, source, width*bpp);
-                dest += atlasPitch;
-                source += texturePitch;
+                missCount++;
             }
         }
     }
+    
+    // The misses are decoded on all the threads, then added to the cache here.
+    u32 workCount = min(missCount, globalWorkQueue.threadCount*4);
+    DecodeCacheMissesWork* works = PushArray(scratchArena, workCount, DecodeCacheMissesWork);
+    for(u32 workIndex = 0; workIndex < workCount; workIndex++)
+    {
+        works[workIndex] = {misses, missCount, workIndex, workCount, atlasMetadata->format};
+        addWorkQueueEntry(&globalWorkQueue, doDecodeCacheMissesWork, &works[workIndex]);
+    }
+    completeAllWork(&globalWorkQueue);
+    for(u32 i = 0; i < missCount; i++)
+    {
+        TextureCacheMiss* miss = &misses[i];
+        if(miss->isDecoded)
+        {
+            entries[miss->fileIndex] = insertCachedTexture(textureCache, miss, atlasMetadata->format);
+        }
+        else
+        {
+            textureCache->staleBytes += (size_t)miss->width*miss->height*getAtlasFormatBytesPerPixel(atlasMetadata->format);
+        }
+    }
+    
+    u32* unreadable = PushArray(scratchArena, files.fileCount, u32);
+    u32 unreadableCount = 0;
+    for(u32 i = 0; i < files.fileCount; i++)
+    {
+        const char* relativePath = getFileListPath(&files, i);
+        CachedTexture* entry = entries[i];
+        if(entry)
+        {
+            Texture* texture = PushStruct(&atlasMetadata->textureArena, Texture);
+            texture->fileNameOffset = internString(&atlasMetadata->fileNames, relativePath);
+            texture->memory = entry->pixels;
+            texture->bpp = entry->bpp;
+            texture->width = entry->width;
+            texture->height = entry->height;
+        }
+        else
+        {
+            unreadable[unreadableCount++] = i;
+        }
+    }
+    atlasMetadata->textureCount = atlasMetadata->textureArena.elementCount;
+    atlasMetadata->report.loadMicroseconds = getMicroseconds() - loadStart;
+    printf("Request %s: %u textures cached, %u decoded, %u unreadable\n", group.name, textureCache->hitCount, textureCache->missCount, unreadableCount);
+    if(atlasMetadata->textureCount == 0)
+    {
+        appendReply(replyArena, "error no readable textures\n");
+        EndTemporaryMemory(requestMemory);
+        destroyTextureAtlasMetadata(atlasMetadata);
+        destroyFileList(&files);
+        return;
+    }
+    
+    group.cache = makeLRUList(atlasMetadata->textureCount);
+    globalRequestError = nullptr;
+    globalIsServingRequest = true;
+    group.textureAtlas = generateTextureAtlas(atlasMetadata, &group.cache, false, false);
+    writeAtlasGroup(&group, 0);
+    globalIsServingRequest = false;
+    if(globalRequestError)
+    {
+        appendReply(replyArena, "error %s\n", globalRequestError);
+        EndTemporaryMemory(requestMemory);
+        FreeMemoryStack(&group.cache.arena);
+        destroyTextureAtlasMetadata(atlasMetadata);
+        destroyFileList(&files);
+        return;
+    }
+    
+    char path[MAX_SCAN_PATH];
+    char fileName[MAX_SCAN_PATH];
+    appendReply(replyArena, "ok %u %u %u %u\n", group.textureAtlas.width, group.textureAtlas.height, group.cache.nodeCount, atlasMetadata->textureCount);
+    snprintf(fileName, sizeof(fileName), "%s.png", group.name);
+    buildFolderPath(path, group.folderPath, fileName);
+    appendReply(replyArena, "atlas %s\n", path);
+    snprintf(fileName, sizeof(fileName), "%sMetadata.txt", group.name);
+    buildFolderPath(path, group.folderPath, fileName);
+    appendReply(replyArena, "metadata %s\n", path);
+    appendReplyTextures(replyArena, atlasMetadata, &group.cache);
+    for(u32 i = 0; i < unreadableCount; i++)
+    {
+        appendReply(replyArena, "unreadable %s\n", getFileListPath(&files, unreadable[i]));
+    }
+    
+    EndTemporaryMemory(requestMemory);
+    FreeMemoryStack(&group.cache.arena);
+    destroyTextureAtlasMetadata(atlasMetadata);
+    destroyFileList(&files);
 }
 
-static Texture generateTextureAtlas(TextureAtlasMetadata* atlasMetadata, LRUCache* cache)
+// NOTE: The rects are named by their index in the request.
+static void serveRectsRequest(char* request, MemoryStack* replyArena)
 {
-    Texture result = {};
-    result.x = 0;
-    result.y = 0;
-    result.width = (u16)atlasMetadata->width;
-    result.height = (u16)atlasMetadata->height;
-    result.bpp = atlasMetadata->bpp;
-    
-    sortTextures(atlasMetadata);
-    result.memory = PushSize(&atlasMetadata->textureArena, result.width * result.height * result.bpp, byte);
-    memset(result.memory, 0, result.bpp * result.width * result.height);
-    atlasMetadata->textureArena.elementCount--;
-    
-    // Figure out the textures xy coordinates in the texture atlas.
-    packTexturesIntoAtlas(GetArrayElements(atlasMetadata->textureArena, Texture), &atlasMetadata->textureNodeArena,  atlasMetadata->textureArena.elementCount, cache, &result);
+    TextureAtlasMetadata atlasMetadata = makeServedTextureAtlasMetadata("", 0, 64, 64, globalOptions.atlasFormat);
+    char* cursor = request;
+    for(char* token = nextManifestToken(&cursor); token; token = nextManifestToken(&cursor))
+    {
+        u32 width = 0;
+        u32 height = 0;
+        char rest;
+        if((sscanf(token, "%ux%u%c", &width, &height, &rest) != 2) || !width || !height || (width > 0xffff) || (height > 0xffff))
+        {
+            appendReply(replyArena, "error expected rects WxH [WxH ...], got %s\n", token);
+            destroyTextureAtlasMetadata(&atlasMetadata);
+            return;
+        }
+        char name[16];
+        snprintf(name, sizeof(name), "%u", atlasMetadata.textureArena.elementCount);
+        Texture* texture = PushStruct(&atlasMetadata.textureArena, Texture);
+        texture->fileNameOffset = internString(&atlasMetadata.fileNames, name);
+        texture->bpp = atlasMetadata.bpp;
+        texture->width = (u16)width;
+        texture->height = (u16)height;
+    }
+    atlasMetadata.textureCount = atlasMetadata.textureArena.elementCount;
+    if(atlasMetadata.textureCount == 0)
+    {
+        appendReply(replyArena, "error expected rects WxH [WxH ...]\n");
+        destroyTextureAtlasMetadata(&atlasMetadata);
+        return;
+    }
     
-    cache->atlasWidth = result.width;
-    cache->atlasHeight = result.height;
+    // Placed like a two phase run places the headers, no atlas pixels are needed.
+    LRUCache cache = makeLRUList(atlasMetadata.textureCount);
+    globalRequestError = nullptr;
+    globalIsServingRequest = true;
+    Texture textureAtlas = sizeTextureAtlas(&atlasMetadata, &globalWorkQueue, 0);
+    packTextures(&atlasMetadata, &cache, &textureAtlas, &globalWorkQueue, 0);
+    globalIsServingRequest = false;
+    if(globalRequestError)
+    {
+        appendReply(replyArena, "error %s\n", globalRequestError);
+    }
+    else
+    {
+        appendReply(replyArena, "ok %u %u %u %u\n", textureAtlas.width, textureAtlas.height, cache.nodeCount, atlasMetadata.textureCount);
+        appendReplyTextures(replyArena, &atlasMetadata, &cache);
+    }
     
-    // Actually build the atlas itself from the textures.
-    buildTextureAtlas(&result, cache);
+    FreeMemoryStack(&cache.arena);
+    destroyTextureAtlasMetadata(&atlasMetadata);
+}
+
+static bool sendReply(HANDLE pipe, MemoryStack* replyArena)
+{
+    DWORD bytesWritten = 0;
+    bool result = WriteFile(pipe, replyArena->base, (DWORD)replyArena->bytes_used, &bytesWritten, 0) && (bytesWritten == replyArena->bytes_used);
     
     return result;
 }
 
-static void writeTextureAtlas(Texture* atlas, u32 textureCount, const char* fileName)
+// NOTE: Returns false when the request asks the server to stop.
+static bool serveRequest(char* request, HANDLE pipe, TextureCache* textureCache, MemoryStack* replyArena)
 {
-    char folderPath[MAX_PATH];
-    setPathToWorkingDir(folderPath);
-    appendToPath(folderPath, fileName);
-    int success = stbi_write_png(folderPath, atlas->width, atlas->height, atlas->bpp, atlas->memory, 0);
-    if(success)
+    char* cursor = request;
+    char* verb = nextManifestToken(&cursor);
+    if(!verb)
     {
-        printf("Success writing texture atlas[%dx%d = %zu] of %d textures\n", atlas->width, atlas->height, (size_t)atlas->width*atlas->height, textureCount);
+        return true;
+    }
+    
+    u64 requestStart = getMicroseconds();
+    bool result = true;
+    TemporaryMemory replyMemory = BeginTemporaryMemory(replyArena);
+    if(strcmp(verb, "pack") == 0)
+    {
+        servePackRequest(cursor, textureCache, replyArena);
+    }
+    else if(strcmp(verb, "rects") == 0)
+    {
+        serveRectsRequest(cursor, replyArena);
+    }
+    else if(strcmp(verb, "quit") == 0)
+    {
+        appendReply(replyArena, "ok\n");
+        result = false;
     }
     else
     {
-        reportError("Error: Could not write texture atlas to disk");
+        appendReply(replyArena, "error unknown request %s\n", verb);
+    }
+    appendReply(replyArena, "end\n");
+    sendReply(pipe, replyArena);
+    EndTemporaryMemory(replyMemory);
+    if(globalOptions.stats)
+    {
+        printf("Serving %s took %llu us\n", verb, getMicroseconds() - requestStart);
     }
+    
+    return result;
 }
 
-static void loadFiles(FileGroup* files, MemoryStack* textureArena, MemoryStack* fileNameArena, u32 textureCount, u32* textureAtlasBpp)
+// NOTE: Serves the requests of one client until it disconnects. Returns false when it stopped the server.
+static bool serveClient(HANDLE pipe, TextureCache* textureCache, char* requestBuffer, MemoryStack* replyArena)
 {
-    char folderPath[MAX_PATH];
-    setPathToWorkingDir(folderPath);
-    
-    for(u32 i = 0; i < textureCount; i++)
+    u32 bufferedBytes = 0;
+    bool isSkipping = false;    // NOTE: the rest of a request too long for the buffer is dropped
+    for(;;)
     {
-        appendToPath(folderPath, files->data.cFileName);
-        openNextFile(files);
-        
-        char* fileName = PushArray(fileNameArena, MAX_PATH, char);
-        copyBytes(fileName, folderPath);
-        setPathToWorkingDir(folderPath);
-        
-        s32 width;
-        s32 height;
-        s32 bpp;
-        byte* memory = stbi_load(fileName, &width, &height, &bpp, 0);
+        DWORD bytesRead = 0;
+        if(!ReadFile(pipe, requestBuffer + bufferedBytes, SERVE_MAX_REQUEST - bufferedBytes, &bytesRead, 0) || (bytesRead == 0))
+        {
+            return true;
+        }
+        bufferedBytes += bytesRead;
         
-        if(memory)
+        char* request = requestBuffer;
+        char* bufferEnd = requestBuffer + bufferedBytes;
+        for(char* p = requestBuffer; p < bufferEnd; p++)
         {
-            Texture* tex = PushStruct(textureArena, Texture);
-            tex->width = (u16)width;
-            tex->height = (u16)height;
-            tex->bpp = bpp;
-            tex->memory = memory;
-            tex->fileName = fileName;
-            
-            if(*textureAtlasBpp == 0)
+            if(*p == '\n')
             {
-                *textureAtlasBpp = bpp;
-            }
-            else
-            {
-                if(*textureAtlasBpp != (u32)bpp)
+                *p = 0;
+                if(!isSkipping && !serveRequest(request, pipe, textureCache, replyArena))
                 {
-                    reportError("Error: Textures in given folder have different number of bytes per pixel!");
+                    return false;
                 }
+                isSkipping = false;
+                request = p + 1;
             }
         }
-        else
+        bufferedBytes = (u32)(bufferEnd - request);
+        memmove(requestBuffer, request, bufferedBytes);
+        if(bufferedBytes == SERVE_MAX_REQUEST)
         {
-            reportError("Error: Could not load .png file");
+            TemporaryMemory replyMemory = BeginTemporaryMemory(replyArena);
+            appendReply(replyArena, "error request longer than %u bytes\nend\n", (u32)SERVE_MAX_REQUEST);
+            sendReply(pipe, replyArena);
+            EndTemporaryMemory(replyMemory);
+            isSkipping = true;
+            bufferedBytes = 0;
         }
     }
 }
 
-static void destroyTextureAtlasMetadata(TextureAtlasMetadata *atlasMetadata)
+// NOTE: A request scans any folder it names and writes into it, so the pipe only lets the user running the server
+// connect. The descriptor points into the buffers of the struct, which has to outlive every pipe made with it.
+struct PipeSecurity
 {
-    Texture* textures = GetArrayElements(atlasMetadata->textureArena, Texture);
-    u32 textureCount = atlasMetadata->textureArena.elementCount-1;
-    
-    for(u32 i = 0; i < textureCount; i++)
+    SECURITY_ATTRIBUTES attributes;
+    SECURITY_DESCRIPTOR descriptor;
+    byte userBuffer[256];   // NOTE: TOKEN_USER followed by the user SID
+    byte aclBuffer[256];
+};
+
+static bool makeCurrentUserPipeSecurity(PipeSecurity* security)
+{
+    HANDLE token;
+    if(!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
     {
-        Texture* texture = &textures[i];
-        stbi_image_free(texture->memory);
+        return false;
     }
-    FreeMemoryStack(&atlasMetadata->textureArena);
-    FreeMemoryStack(&atlasMetadata->textureNodeArena);
-    FreeMemoryStack(&atlasMetadata->fileNameArena);
+    DWORD userSize = 0;
+    bool result = GetTokenInformation(token, TokenUser, security->userBuffer, sizeof(security->userBuffer), &userSize) != 0;
+    CloseHandle(token);
+    if(!result)
+    {
+        return false;
+    }
+    
+    PSID userSid = ((TOKEN_USER *)security->userBuffer)->User.Sid;
+    ACL* acl = (ACL *)security->aclBuffer;
+    result = InitializeAcl(acl, sizeof(security->aclBuffer), ACL_REVISION) &&
+        AddAccessAllowedAce(acl, ACL_REVISION, GENERIC_ALL, userSid) &&
+        InitializeSecurityDescriptor(&security->descriptor, SECURITY_DESCRIPTOR_REVISION) &&
+        SetSecurityDescriptorDacl(&security->descriptor, TRUE, acl, FALSE);
+    security->attributes.nLength = sizeof(security->attributes);
+    security->attributes.lpSecurityDescriptor = &security->descriptor;
+    security->attributes.bInheritHandle = FALSE;
+    
+    return result;
 }
 
-static TextureAtlasMetadata generateTextureAtlasMetadata(u32 width, u32 height, u32 bpp)
+static void runServer(const char* pipeName)
 {
-    TextureAtlasMetadata result = {};
-    
-    char workingFolderPath[MAX_PATH];
-    char wildcardFolderPath[MAX_PATH];
-    setPathToWorkingDir(workingFolderPath);
-    setPathToWorkingDir(wildcardFolderPath);
-    appendToPath(wildcardFolderPath, "*.png");
-    
-    FileGroup* files = createFileGroup(wildcardFolderPath);
-    const u32 textureCount = files->fileCount;
-    const u32 textureAtlasSize = width * height * bpp;
-    
-    MemoryStack textureArena = InitStackMemory(textureCount * sizeof(Texture) + textureAtlasSize);
-    
-    MemoryStack textureNodeArena = InitStackMemory((1 + textureCount * 4) * sizeof(TextureNode));
+    char pipePath[MAX_SCAN_PATH];
+    snprintf(pipePath, sizeof(pipePath), "\\\\.\\pipe\\%s", pipeName);
+    TextureCache textureCache = makeTextureCache();
+    MemoryStack requestArena = InitGrowableStackMemory();
+    char* requestBuffer = PushArray(&requestArena, SERVE_MAX_REQUEST, char);
+    MemoryStack replyArena = InitGrowableStackMemory();
+    PipeSecurity security = {};
+    bool isRunning = makeCurrentUserPipeSecurity(&security);
+    if(!isRunning)
+    {
+        reportError("Error: Could not restrict the request pipe to the current user");
+    }
+    else
+    {
+        printf("Serving atlas requests on %s\n", pipePath);
+    }
     
-    MemoryStack fileNameArena = InitStackMemory(textureCount*MAX_PATH);
+    while(isRunning)
+    {
+        HANDLE pipe = CreateNamedPipeA(pipePath, PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE|PIPE_READMODE_BYTE|PIPE_WAIT|PIPE_REJECT_REMOTE_CLIENTS, 1, SERVE_PIPE_BUFFER_SIZE, SERVE_PIPE_BUFFER_SIZE, 0, &security.attributes);
+        if(pipe == INVALID_HANDLE_VALUE)
+        {
+            reportError("Error: Could not create the request pipe");
+            break;
+        }
+        // A client that connected before ConnectNamedPipe was called is already there.
+        if(ConnectNamedPipe(pipe, 0) || (GetLastError() == ERROR_PIPE_CONNECTED))
+        {
+            isRunning = serveClient(pipe, &textureCache, requestBuffer, &replyArena);
+            FlushFileBuffers(pipe);
+        }
+        DisconnectNamedPipe(pipe);
+        CloseHandle(pipe);
+    }
     
-    loadFiles(files, &textureArena, &fileNameArena, textureCount, &result.bpp);
-    result.textureArena = textureArena;
-    result.textureNodeArena = textureNodeArena;
-    result.fileNameArena = fileNameArena;
-    result.maxSize = textureAtlasSize;
-    result.textureCount = textureCount;
+    if(globalOptions.stats)
+    {
+        PrintMemoryStackStats("Texture cache pixels", &textureCache.pixelArena);
+    }
+    destroyTextureCache(&textureCache);
+    FreeMemoryStack(&replyArena);
+    FreeMemoryStack(&requestArena);
+}
+
+// NOTE: A whole number in [minValue, maxValue], anything else is rejected instead of wrapping around in the u32.
+static bool parseBoundedOption(const char* option, const char* value, u32 minValue, u32 maxValue, u32* result)
+{
+    char* end;
+    long parsed = strtol(value, &end, 10);
+    if((end == value) || *end || (parsed < (long)minValue) || (parsed > (long)maxValue))
+    {
+        fprintf(stderr, "%s %s must be between %u and %u\n", option, value, minValue, maxValue);
+        return false;
+    }
+    *result = (u32)parsed;
     
-    result.width = width;
-    result.height = height;
-    result.bpp = bpp;
+    return true;
+}
+
+static bool parseProgramOptions(int argc, const char **argv)
+{
+    // NOTE: argv[1] is always the folder path, options follow it.
+    globalOptions.sdfDownscale = 1;
+    for(int i = 2; i < argc; i++)
+    {
+        const char* option = argv[i];
+        if(strcmp(option, "-concurrent") == 0)
+        {
+            globalOptions.concurrentInsert = true;
+        }
+        else if(strcmp(option, "-twophase") == 0)
+        {
+            globalOptions.twoPhase = true;
+        }
+        else if(strcmp(option, "-frontcodednames") == 0)
+        {
+            globalOptions.frontCodedNames = true;
+        }
+        else if(strcmp(option, "-batch") == 0)
+        {
+            globalOptions.batch = true;
+        }
+        else if(strcmp(option, "-packsearch") == 0)
+        {
+            globalOptions.packSearch = true;
+        }
+        else if((strcmp(option, "-fit") == 0) && (i + 1 < argc))
+        {
+            const char* step = argv[++i];
+            if(strcmp(step, "pow2") == 0)
+            {
+                globalOptions.fitPowerOfTwo = true;
+            }
+            else
+            {
+                // The candidate sides are multiples of the step up to the largest atlas, they are packed as u16.
+                s32 multiple = atoi(step);
+                if((multiple <= 0) || (multiple > MAX_FIT_ATLAS_SIZE))
+                {
+                    fprintf(stderr, "Unknown atlas size step: %s, it must be between 1 and %u\n", step, MAX_FIT_ATLAS_SIZE);
+                    return false;
+                }
+                globalOptions.fitMultiple = (u32)multiple;
+            }
+        }
+        else if(strcmp(option, "-deterministic") == 0)
+        {
+            globalOptions.deterministic = true;
+        }
+        else if(strcmp(option, "-report") == 0)
+        {
+            globalOptions.report = true;
+        }
+        else if(strcmp(option, "-overlay") == 0)
+        {
+            globalOptions.overlay = true;
+        }
+        else if(strcmp(option, "-validate") == 0)
+        {
+            globalOptions.validate = true;
+        }
+        else if(strcmp(option, "-recursive") == 0)
+        {
+            globalOptions.scan.recursive = true;
+        }
+        else if((strcmp(option, "-include") == 0) && (i + 1 < argc) && (globalOptions.scan.includeCount < MAX_SCAN_PATTERNS))
+        {
+            globalOptions.scan.includePatterns[globalOptions.scan.includeCount++] = argv[++i];
+        }
+        else if((strcmp(option, "-exclude") == 0) && (i + 1 < argc) && (globalOptions.scan.excludeCount < MAX_SCAN_PATTERNS))
+        {
+            globalOptions.scan.excludePatterns[globalOptions.scan.excludeCount++] = argv[++i];
+        }
+        else if((strcmp(option, "-format") == 0) && (i + 1 < argc))
+        {
+            if(!parseAtlasFormat(argv[++i], &globalOptions.atlasFormat))
+            {
+                fprintf(stderr, "Unknown atlas format: %s\n", argv[i]);
+                return false;
+            }
+        }
+        else if((strcmp(option, "-sdf") == 0) && (i + 1 < argc))
+        {
+            if(!parseBoundedOption(option, argv[++i], 0, MAX_SDF_SPREAD, &globalOptions.sdfSpread))
+            {
+                return false;
+            }
+        }
+        else if((strcmp(option, "-sdfdownscale") == 0) && (i + 1 < argc))
+        {
+            if(!parseBoundedOption(option, argv[++i], 1, MAX_SDF_DOWNSCALE, &globalOptions.sdfDownscale))
+            {
+                return false;
+            }
+        }
+        else if((strcmp(option, "-padding") == 0) && (i + 1 < argc))
+        {
+            if(!parseBoundedOption(option, argv[++i], 0, MAX_TEXTURE_PADDING, &globalOptions.padding))
+            {
+                return false;
+            }
+        }
+        else if((strcmp(option, "-extrude") == 0) && (i + 1 < argc))
+        {
+            if(!parseBoundedOption(option, argv[++i], 0, MAX_TEXTURE_EXTRUDE, &globalOptions.extrude))
+            {
+                return false;
+            }
+        }
+        else if(strcmp(option, "-stats") == 0)
+        {
+            globalOptions.stats = true;
+        }
+        else if(strcmp(option, "-watch") == 0)
+        {
+            globalOptions.watch = true;
+        }
+        else if(strcmp(option, "-serve") == 0)
+        {
+            globalOptions.serve = true;
+        }
+        else if(strcmp(option, "-premultiply") == 0)
+        {
+            globalOptions.premultiply = true;
+        }
+        else if(strcmp(option, "-srgb") == 0)
+        {
+            globalOptions.premultiply = true;
+            globalOptions.srgb = true;
+        }
+        else if((strcmp(option, "-threads") == 0) && (i + 1 < argc))
+        {
+            globalOptions.threadCount = (u32)atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", option);
+            return false;
+        }
+    }
     
-    destroyFileGroup(files);
+    if(globalOptions.deterministic)
+    {
+        // Where the concurrent inserter places a texture depends on which thread gets there first.
+        if(globalOptions.concurrentInsert)
+        {
+            fprintf(stderr, "-deterministic can't be used with -concurrent\n");
+            return false;
+        }
+        globalOptions.scan.sorted = true;
+        stbi_write_png_compression_level = DETERMINISTIC_PNG_COMPRESSION_LEVEL;
+        stbi_write_force_png_filter = DETERMINISTIC_PNG_FILTER;
+    }
+    if(globalOptions.batch && globalOptions.concurrentInsert)
+    {
+        // The groups are packed by the job graph, one tree packer per group.
+        fprintf(stderr, "-concurrent can't be used with -batch\n");
+        return false;
+    }
+    if((globalOptions.fitPowerOfTwo || globalOptions.fitMultiple) && globalOptions.concurrentInsert)
+    {
+        // The size is fitted with the tree packer, the concurrent one places differently.
+        fprintf(stderr, "-fit can't be used with -concurrent\n");
+        return false;
+    }
+    if(globalOptions.packSearch && globalOptions.concurrentInsert)
+    {
+        // The search repacks with the tree packer under several orders, the concurrent one places as the threads arrive.
+        fprintf(stderr, "-packsearch can't be used with -concurrent\n");
+        return false;
+    }
+    if(globalOptions.sdfSpread)
+    {
+        // The fields are computed from the decoded coverage before packing, the atlas holds one byte per pixel.
+        if(globalOptions.twoPhase || globalOptions.batch)
+        {
+            fprintf(stderr, "-sdf can't be used with -twophase or -batch\n");
+            return false;
+        }
+        globalOptions.atlasFormat = AtlasFormat::R8;
+    }
+    if(globalOptions.watch && (globalOptions.twoPhase || globalOptions.batch || globalOptions.sdfSpread))
+    {
+        // Only a one phase run keeps every texture decoded, the distance fields replace them.
+        fprintf(stderr, "-watch can't be used with -twophase, -batch or -sdf\n");
+        return false;
+    }
+    if(globalOptions.serve && (globalOptions.twoPhase || globalOptions.batch || globalOptions.sdfSpread || globalOptions.watch))
+    {
+        // The cache hands out the decoded textures as they are, a request must not change them.
+        fprintf(stderr, "-serve can't be used with -twophase, -batch, -sdf or -watch\n");
+        return false;
+    }
+    if(globalOptions.watch)
+    {
+        // The outputs are written into the watched folder, a rescan must not pack the last atlas.
+        for(u32 i = 0; i < ArrayCount(atlasOutputNames); i++)
+        {
+            if(globalOptions.scan.excludeCount == MAX_SCAN_PATTERNS)
+            {
+                fprintf(stderr, "-watch needs %u free -exclude slots\n", (u32)ArrayCount(atlasOutputNames));
+                return false;
+            }
+            globalOptions.scan.excludePatterns[globalOptions.scan.excludeCount++] = atlasOutputNames[i];
+        }
+    }
+    if(globalOptions.premultiply)
+    {
+        if(!canPremultiplyFormat(globalOptions.atlasFormat))
+        {
+            fprintf(stderr, "-premultiply needs a format with alpha, rgba8, bgra8 or rgba16\n");
+            return false;
+        }
+        // Built before the workers start, they only read it.
+        initPremultiplyTable(&globalPremultiplyTable, globalOptions.srgb);
+    }
     
-    return result;
+    return true;
 }
 
 int main(int argc, const char **argv)
 {
     const char* programName = argv[0];
-    if(argc == 2)
+    if((argc >= 2) && parseProgramOptions(argc, argv))
     {
-        beginTimer();
+        initTimer();
         globalFolderPath = argv[1];
         if(strcmp(globalFolderPath, "help") == 0)
         {
@@ -1105,23 +4777,81 @@ int main(int argc, const char **argv)
         }
         
         printf("Start of program!\n");
-        TextureAtlasMetadata atlasMetadata = generateTextureAtlasMetadata(64, 64, 4);
-        
-        LRUCache cache = makeLRUList(atlasMetadata.textureCount * sizeof(LRUNode));
-        printf("Start generating texture atlas...\n");
-        Texture textureAtlas = generateTextureAtlas(&atlasMetadata, &cache);
-        printf("Texture atlas generated\n");
+        makeWorkQueue(&globalWorkQueue, globalOptions.threadCount);
         
-        writeTextureAtlasMetadata(&atlasMetadata, &cache, "atlasMetadata.txt");
+        if(globalOptions.batch)
+        {
+            runBatch(globalFolderPath);
+            endTimer();
+            return 0;
+        }
+        if(globalOptions.serve)
+        {
+            runServer(globalFolderPath);
+            endTimer();
+            return 0;
+        }
         
-        writeTextureAtlas(&textureAtlas, cache.nodeCount, "atlas.png");
-        destroyTextureAtlasMetadata(&atlasMetadata);
+        // A watch runs cold again when textures were added, removed or renamed.
+        bool isColdRun = true;
+        while(isColdRun)
+        {
+            TextureAtlasMetadata atlasMetadata = generateTextureAtlasMetadata(globalFolderPath, &globalOptions.scan, 64, 64, globalOptions.atlasFormat, globalOptions.twoPhase);
+            if(globalOptions.sdfSpread)
+            {
+                generateSignedDistanceFields(&atlasMetadata, globalOptions.sdfSpread, globalOptions.sdfDownscale, &globalWorkQueue);
+            }
+            
+            LRUCache cache = makeLRUList(atlasMetadata.textureCount);
+            printf("Start generating texture atlas...\n");
+            // Everything after the textures, the atlas pixels, is dropped again when a watch repacks.
+            TemporaryMemory atlasMemory = BeginTemporaryMemory(&atlasMetadata.textureArena);
+            // Premultiplying, packing, building and writing the atlas are one job graph.
+            Texture textureAtlas = generateTextureAtlas(&atlasMetadata, &cache, globalOptions.premultiply && !globalOptions.twoPhase, true);
+            printf("Texture atlas generated\n");
+            
+            isColdRun = globalOptions.watch && watchTextureAtlas(&atlasMetadata, &cache, &textureAtlas, &atlasMemory);
+            
+            if(globalOptions.stats)
+            {
+                PrintMemoryStackStats("Texture arena", &atlasMetadata.textureArena);
+                PrintMemoryStackStats("Texture node arena", &atlasMetadata.textureNodeArena);
+                PrintMemoryStackStats("File name table", &atlasMetadata.fileNames.stringArena);
+            }
+            FreeMemoryStack(&cache.arena);
+            destroyTextureAtlasMetadata(&atlasMetadata);
+        }
         endTimer();
     }
     else
     {
         fprintf(stderr, "Invalid usage of: %s\n", programName);
-        fprintf(stderr, "Valid usage: %s 'path to image folder'\n", programName);
+        fprintf(stderr, "Valid usage: %s 'path to image folder' [options]\n", programName);
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  -concurrent     place and blit textures from all worker threads at once\n");
+        fprintf(stderr, "  -twophase       pack from the .png headers, then decode straight into the atlas\n");
+        fprintf(stderr, "  -batch          the path is a manifest with one 'name folder [scan options]' group per line\n");
+        fprintf(stderr, "  -packsearch     try several sort orders and start sizes in parallel and keep the smallest atlas\n");
+        fprintf(stderr, "  -fit STEP       binary search the smallest atlas holding every texture, STEP is pow2 or the multiple the sides are rounded to\n");
+        fprintf(stderr, "  -deterministic  byte identical output for identical input, files in canonical order, content hash in the metadata\n");
+        fprintf(stderr, "  -report         write atlasReport.json, or <name>Report.json per group, with packing quality, timings and peak memory\n");
+        fprintf(stderr, "  -overlay        write atlasOverlay.png, or <name>Overlay.png per group, free space magenta, gutters orange, evicted red\n");
+        fprintf(stderr, "  -stats          print how long every stage took and how much memory the arenas used\n");
+        fprintf(stderr, "  -validate       check no two textures overlap and all lie inside the atlas\n");
+        fprintf(stderr, "  -recursive      scan sub folders too\n");
+        fprintf(stderr, "  -include GLOB   files to pack, *.png by default, repeatable\n");
+        fprintf(stderr, "  -exclude GLOB   files or folders to skip, repeatable\n");
+        fprintf(stderr, "  -frontcodednames  write metadata names as prefix shared with the previous name plus the rest\n");
+        fprintf(stderr, "  -format NAME    atlas pixel format, rgba8 by default, bgra8, r8, rg8, r16 or rgba16, inputs of any channel count are converted\n");
+        fprintf(stderr, "  -sdf SPREAD     pack signed distance fields of the alpha, or gray, reaching SPREAD pixels past the edges, forces r8\n");
+        fprintf(stderr, "  -sdfdownscale N  store the distance fields at 1/N of the source resolution, 1 by default\n");
+        fprintf(stderr, "  -padding N      keep N empty pixels around every texture and its extrusion\n");
+        fprintf(stderr, "  -extrude N      repeat the edge pixels of every texture N pixels outward, the padding comes on top\n");
+        fprintf(stderr, "  -watch          stay resident and update the atlas as the textures change, a changed size repacks\n");
+        fprintf(stderr, "  -serve          the path is a pipe name, serve pack and rects requests on \\\\.\\pipe\\NAME keeping decoded textures warm\n");
+        fprintf(stderr, "  -premultiply    multiply the colors by the alpha as the textures are decoded, needs rgba8, bgra8 or rgba16\n");
+        fprintf(stderr, "  -srgb           premultiply in linear light and encode the colors back to srgb, implies -premultiply\n");
+        fprintf(stderr, "  -threads N      number of threads including the main thread, 0 for all processors\n");
     }
     
     return 0;
@@ -0,0 +1,281 @@
+//
+// pixel format conversion
+//
+
+// NOTE: Every decoded image is converted to the atlas format right away, whatever its channel count,
+// so folders mixing gray, gray alpha, rgb and rgba images pack in one pass.
+
+enum struct AtlasFormat
+{
+    RGBA8,
+    BGRA8,      // NOTE: written to the .png as is, viewers show red and blue swapped
+    R8,         // NOTE: the alpha of the source when it has one, gray or red otherwise
+    RG8,        // NOTE: gray and alpha, or red and green
+    R16,
+    RGBA16,     // NOTE: decoded with 16 bits per channel, 8 bit files are widened
+};
+
+struct AtlasFormatInfo
+{
+    const char* name;
+    u32 channels;
+    u32 bytesPerChannel;
+};
+
+static const AtlasFormatInfo atlasFormatInfos[] =
+{
+    {"rgba8", 4, 1},
+    {"bgra8", 4, 1},
+    {"r8", 1, 1},
+    {"rg8", 2, 1},
+    {"r16", 1, 2},
+    {"rgba16", 4, 2},
+};
+
+static const AtlasFormatInfo* getAtlasFormatInfo(AtlasFormat format)
+{
+    return &atlasFormatInfos[(u32)format];
+}
+
+static u32 getAtlasFormatBytesPerPixel(AtlasFormat format)
+{
+    const AtlasFormatInfo* info = getAtlasFormatInfo(format);
+    u32 result = info->channels*info->bytesPerChannel;
+    
+    return result;
+}
+
+static bool isAtlasFormat16Bit(AtlasFormat format)
+{
+    return getAtlasFormatInfo(format)->bytesPerChannel == 2;
+}
+
+static bool parseAtlasFormat(const char* name, AtlasFormat* format)
+{
+    for(u32 i = 0; i < ArrayCount(atlasFormatInfos); i++)
+    {
+        if(strcmp(name, atlasFormatInfos[i].name) == 0)
+        {
+            *format = (AtlasFormat)i;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+#define PIXEL_CHANNEL_OPAQUE -1
+
+struct PixelConversion;
+
+// NOTE: Converts whole steps of pixels and returns how many it converted.
+typedef u32 ConvertPixelSteps(const PixelConversion* conversion, const byte* source, byte* dest, u32 simdPixelCount);
+
+struct PixelConversion
+{
+    __m128i shuffle;    // NOTE: gathers the source bytes of one step of pixels, 0x80 lanes come out zero
+    __m128i fill;       // NOTE: or'ed in after the shuffle, opaque alpha for sources that have none
+    u32 sourcePixelBytes;
+    u32 destPixelBytes;
+    u32 pixelsPerStep;  // NOTE: a step reads at most 16 bytes and writes 4, 8 or 16
+    s32 byteMap[8];     // NOTE: source byte of each byte of a destination pixel, or opaque
+    ConvertPixelSteps* convertSteps;    // NOTE: the kernel of the atlas format
+};
+
+// NOTE: One step kernel per atlas format, its pixel size, step and store width are constants. Only the source
+// pixel size is left to run time, the shuffle covers the channel order.
+#define CONVERT_PIXEL_STEPS_KERNEL(name, destPixelBytes, pixelsPerStep, store) \
+static u32 name(const PixelConversion* conversion, const byte* source, byte* dest, u32 simdPixelCount) \
+{ \
+    u32 sourcePixelBytes = conversion->sourcePixelBytes; \
+    u32 i = 0; \
+    for(; i < simdPixelCount; i += pixelsPerStep) \
+    { \
+        __m128i pixels = _mm_loadu_si128((__m128i *)(source + i*sourcePixelBytes)); \
+        pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, conversion->shuffle), conversion->fill); \
+        byte* destStep = dest + i*destPixelBytes; \
+        store; \
+    } \
+    return i; \
+}
+
+CONVERT_PIXEL_STEPS_KERNEL(convertPixelStepsRGBA8, 4, 4, _mm_storeu_si128((__m128i *)destStep, pixels))
+CONVERT_PIXEL_STEPS_KERNEL(convertPixelStepsR8, 1, 4, *(u32 *)destStep = (u32)_mm_cvtsi128_si32(pixels))
+CONVERT_PIXEL_STEPS_KERNEL(convertPixelStepsRG8, 2, 4, _mm_storel_epi64((__m128i *)destStep, pixels))
+CONVERT_PIXEL_STEPS_KERNEL(convertPixelStepsR16, 2, 2, *(u32 *)destStep = (u32)_mm_cvtsi128_si32(pixels))
+CONVERT_PIXEL_STEPS_KERNEL(convertPixelStepsRGBA16, 8, 2, _mm_storeu_si128((__m128i *)destStep, pixels))
+
+static ConvertPixelSteps* getConvertPixelSteps(AtlasFormat format)
+{
+    ConvertPixelSteps* result = nullptr;
+    switch(format)
+    {
+        case AtlasFormat::RGBA8:
+        case AtlasFormat::BGRA8: result = convertPixelStepsRGBA8; break;
+        case AtlasFormat::R8: result = convertPixelStepsR8; break;
+        case AtlasFormat::RG8: result = convertPixelStepsRG8; break;
+        case AtlasFormat::R16: result = convertPixelStepsR16; break;
+        case AtlasFormat::RGBA16: result = convertPixelStepsRGBA16; break;
+    }
+    
+    return result;
+}
+
+static PixelConversion makePixelConversion(u32 sourceChannels, AtlasFormat format)
+{
+    const AtlasFormatInfo* info = getAtlasFormatInfo(format);
+    u32 channelBytes = info->bytesPerChannel;
+    
+    PixelConversion result = {};
+    result.sourcePixelBytes = sourceChannels*channelBytes;
+    result.destPixelBytes = info->channels*channelBytes;
+    result.pixelsPerStep = 16 / (4*channelBytes);
+    result.convertSteps = getConvertPixelSteps(format);
+    
+    // Gray is replicated to the color channels, the alpha is opaque unless the source has one.
+    bool hasAlpha = (sourceChannels == 2) || (sourceChannels == 4);
+    s32 red = 0;
+    s32 green = (sourceChannels >= 3) ? 1 : 0;
+    s32 blue = (sourceChannels >= 3) ? 2 : 0;
+    s32 alpha = hasAlpha ? (s32)sourceChannels - 1 : PIXEL_CHANNEL_OPAQUE;
+    s32 channelMap[4] = {red, green, blue, alpha};
+    switch(format)
+    {
+        case AtlasFormat::BGRA8:
+        {
+            channelMap[0] = blue;
+            channelMap[2] = red;
+        } break;
+        case AtlasFormat::R8:
+        case AtlasFormat::R16:
+        {
+            channelMap[0] = hasAlpha ? alpha : red;
+        } break;
+        case AtlasFormat::RG8:
+        {
+            channelMap[1] = (sourceChannels == 2) ? alpha : ((sourceChannels == 1) ? PIXEL_CHANNEL_OPAQUE : green);
+        } break;
+        default: break;
+    }
+    
+    for(u32 channel = 0; channel < info->channels; channel++)
+    {
+        for(u32 b = 0; b < channelBytes; b++)
+        {
+            s32 sourceChannel = channelMap[channel];
+            result.byteMap[channel*channelBytes + b] = (sourceChannel == PIXEL_CHANNEL_OPAQUE) ? PIXEL_CHANNEL_OPAQUE : sourceChannel*(s32)channelBytes + (s32)b;
+        }
+    }
+    
+    alignas(16) u8 shuffle[16];
+    alignas(16) u8 fill[16];
+    memset(shuffle, 0x80, sizeof(shuffle));
+    memset(fill, 0, sizeof(fill));
+    for(u32 pixel = 0; pixel < result.pixelsPerStep; pixel++)
+    {
+        for(u32 b = 0; b < result.destPixelBytes; b++)
+        {
+            s32 sourceByte = result.byteMap[b];
+            u32 lane = pixel*result.destPixelBytes + b;
+            shuffle[lane] = (sourceByte == PIXEL_CHANNEL_OPAQUE) ? 0x80 : (u8)(pixel*result.sourcePixelBytes + sourceByte);
+            fill[lane] = (sourceByte == PIXEL_CHANNEL_OPAQUE) ? 0xff : 0;
+        }
+    }
+    result.shuffle = _mm_load_si128((__m128i *)shuffle);
+    result.fill = _mm_load_si128((__m128i *)fill);
+    
+    return result;
+}
+
+// NOTE: True when the decoded bytes already are in the atlas format and can be copied as they are.
+static bool isIdentityConversion(u32 sourceChannels, AtlasFormat format)
+{
+    bool result = false;
+    switch(format)
+    {
+        case AtlasFormat::RGBA8: result = (sourceChannels == 4); break;
+        case AtlasFormat::R8: result = (sourceChannels == 1); break;
+        case AtlasFormat::RG8: result = (sourceChannels == 2); break;
+        default: break;
+    }
+    
+    return result;
+}
+
+static void convertPixels(const PixelConversion* conversion, const byte* source, byte* dest, u32 pixelCount)
+{
+    u32 sourcePixelBytes = conversion->sourcePixelBytes;
+    u32 destPixelBytes = conversion->destPixelBytes;
+    u32 pixelsPerStep = conversion->pixelsPerStep;
+    u32 i = 0;
+    
+    // Each step loads 16 source bytes so the steps stop while that is still in bounds.
+    if(pixelCount*sourcePixelBytes >= 16)
+    {
+        u32 simdPixelCount = (pixelCount*sourcePixelBytes - 16) / sourcePixelBytes + 1;
+        simdPixelCount -= simdPixelCount % pixelsPerStep;
+        i = conversion->convertSteps(conversion, source, dest, simdPixelCount);
+    }
+    
+    for(; i < pixelCount; i++)
+    {
+        const byte* sourcePixel = source + i*sourcePixelBytes;
+        byte* destPixel = dest + i*destPixelBytes;
+        for(u32 b = 0; b < destPixelBytes; b++)
+        {
+            s32 sourceByte = conversion->byteMap[b];
+            destPixel[b] = (sourceByte == PIXEL_CHANNEL_OPAQUE) ? 0xff : sourcePixel[sourceByte];
+        }
+    }
+}
+
+// NOTE: source is tightly packed, dest rows are destPitch bytes apart.
+static void convertPixelRows(const PixelConversion* conversion, const byte* source, u32 width, u32 height, byte* dest, u32 destPitch)
+{
+    u32 sourcePitch = width*conversion->sourcePixelBytes;
+    for(u32 y = 0; y < height; y++)
+    {
+        convertPixels(conversion, source, dest, width);
+        source += sourcePitch;
+        dest += destPitch;
+    }
+}
+
+// NOTE: Writes count copies of one pixel, the pixel is broadcast across a register and stored 16 bytes at a time.
+// One kernel per pixel size, so the tail stores a whole pixel at once.
+typedef void FillPixelRun(byte* dest, const byte* pixel, u32 count);
+
+#define FILL_PIXEL_RUN_KERNEL(name, Pixel, broadcastPixel) \
+static void name(byte* dest, const byte* pixel, u32 count) \
+{ \
+    Pixel value = *(const Pixel *)pixel; \
+    __m128i broadcast = broadcastPixel; \
+    u32 size = count*sizeof(Pixel); \
+    u32 i = 0; \
+    for(; i + 16 <= size; i += 16) \
+    { \
+        _mm_storeu_si128((__m128i *)(dest + i), broadcast); \
+    } \
+    for(; i < size; i += sizeof(Pixel)) \
+    { \
+        *(Pixel *)(dest + i) = value; \
+    } \
+}
+
+FILL_PIXEL_RUN_KERNEL(fillPixelRun8, u8, _mm_set1_epi8((s8)value))
+FILL_PIXEL_RUN_KERNEL(fillPixelRun16, u16, _mm_set1_epi16((s16)value))
+FILL_PIXEL_RUN_KERNEL(fillPixelRun32, u32, _mm_set1_epi32((s32)value))
+FILL_PIXEL_RUN_KERNEL(fillPixelRun64, u64, _mm_set1_epi64x((s64)value))
+
+static FillPixelRun* getFillPixelRun(u32 bytesPerPixel)
+{
+    FillPixelRun* result = fillPixelRun64;
+    switch(bytesPerPixel)
+    {
+        case 1: result = fillPixelRun8; break;
+        case 2: result = fillPixelRun16; break;
+        case 4: result = fillPixelRun32; break;
+    }
+    
+    return result;
+}
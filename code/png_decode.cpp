@@ -0,0 +1,277 @@
+//
+// png decoding straight into destination rows
+//
+
+// NOTE: Handles the common case of 8 bit, non interlaced, non paletted images.
+// Everything else goes through stb_image.
+
+#define PNG_COLOR_GRAY 0
+#define PNG_COLOR_RGB 2
+#define PNG_COLOR_PALETTE 3
+#define PNG_COLOR_GRAY_ALPHA 4
+#define PNG_COLOR_RGBA 6
+
+struct PNGImageInfo
+{
+    u32 width;
+    u32 height;
+    u32 channels;
+    u8 bitDepth;
+    u8 colorType;
+    u8 interlaceMethod;
+    bool hasTransparencyChunk;
+    const byte* imageData;      // NOTE: points into the file when there is a single IDAT chunk
+    u32 imageDataSize;
+    u32 imageDataChunkCount;
+};
+
+static u32 readBigEndian32(const byte* p)
+{
+    u32 result = ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+    return result;
+}
+
+static u32 getPNGChannelCount(u8 colorType)
+{
+    u32 result = 0;
+    switch(colorType)
+    {
+        case PNG_COLOR_GRAY: result = 1; break;
+        case PNG_COLOR_GRAY_ALPHA: result = 2; break;
+        case PNG_COLOR_RGB: result = 3; break;
+        case PNG_COLOR_RGBA: result = 4; break;
+    }
+    
+    return result;
+}
+
+static bool parsePNGChunks(const byte* data, u32 size, PNGImageInfo* info)
+{
+    static const byte signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    *info = {};
+    if((size < 8) || (memcmp(data, signature, 8) != 0))
+    {
+        return false;
+    }
+    
+    bool hasHeader = false;
+    u32 offset = 8;
+    while(offset + 12 <= size)
+    {
+        u32 chunkSize = readBigEndian32(data + offset);
+        const byte* chunkType = data + offset + 4;
+        const byte* chunkData = data + offset + 8;
+        if(chunkSize > size - offset - 12)
+        {
+            return false;
+        }
+        
+        if(memcmp(chunkType, "IHDR", 4) == 0 && (chunkSize == 13))
+        {
+            info->width = readBigEndian32(chunkData);
+            info->height = readBigEndian32(chunkData + 4);
+            info->bitDepth = chunkData[8];
+            info->colorType = chunkData[9];
+            info->interlaceMethod = chunkData[12];
+            info->channels = getPNGChannelCount(info->colorType);
+            hasHeader = true;
+        }
+        else if(memcmp(chunkType, "tRNS", 4) == 0)
+        {
+            info->hasTransparencyChunk = true;
+        }
+        else if(memcmp(chunkType, "IDAT", 4) == 0)
+        {
+            if(!info->imageData)
+            {
+                info->imageData = chunkData;
+            }
+            info->imageDataSize += chunkSize;
+            info->imageDataChunkCount++;
+        }
+        else if(memcmp(chunkType, "IEND", 4) == 0)
+        {
+            break;
+        }
+        offset += chunkSize + 12;
+    }
+    
+    return hasHeader && info->imageData;
+}
+
+// NOTE: Concatenates split IDAT chunks so the zlib stream is contiguous. Walks the chunks like parsePNGChunks
+// and stops at IEND the same way, null when they don't add up to the size it counted.
+static const byte* gatherPNGImageData(const byte* data, u32 size, PNGImageInfo* info, MemoryStack* scratchArena)
+{
+    if(info->imageDataChunkCount == 1)
+    {
+        return info->imageData;
+    }
+    
+    byte* result = PushSize(scratchArena, info->imageDataSize, byte);
+    u32 gatheredSize = 0;
+    u32 offset = 8;
+    while(offset + 12 <= size)
+    {
+        u32 chunkSize = readBigEndian32(data + offset);
+        const byte* chunkType = data + offset + 4;
+        if(chunkSize > size - offset - 12)
+        {
+            return nullptr;
+        }
+        
+        if(memcmp(chunkType, "IDAT", 4) == 0)
+        {
+            if(chunkSize > info->imageDataSize - gatheredSize)
+            {
+                return nullptr;
+            }
+            memcpy(result + gatheredSize, data + offset + 8, chunkSize);
+            gatheredSize += chunkSize;
+        }
+        else if(memcmp(chunkType, "IEND", 4) == 0)
+        {
+            break;
+        }
+        offset += chunkSize + 12;
+    }
+    
+    return (gatheredSize == info->imageDataSize) ? result : nullptr;
+}
+
+static byte paethPredictor(s32 a, s32 b, s32 c)
+{
+    s32 p = a + b - c;
+    s32 pa = abs(p - a);
+    s32 pb = abs(p - b);
+    s32 pc = abs(p - c);
+    
+    byte result;
+    if(pa <= pb && pa <= pc)
+    {
+        result = (byte)a;
+    }
+    else if(pb <= pc)
+    {
+        result = (byte)b;
+    }
+    else
+    {
+        result = (byte)c;
+    }
+    
+    return result;
+}
+
+// NOTE: prior is the previous already unfiltered row, which is the row above in the destination.
+static bool unfilterPNGRow(byte filter, const byte* raw, byte* out, const byte* prior, u32 rowBytes, u32 bpp)
+{
+    bool result = true;
+    switch(filter)
+    {
+        case 0:
+        {
+            memcpy(out, raw, rowBytes);
+        } break;
+        case 1:
+        {
+            memcpy(out, raw, bpp);
+            for(u32 i = bpp; i < rowBytes; i++)
+            {
+                out[i] = raw[i] + out[i - bpp];
+            }
+        } break;
+        case 2:
+        {
+            for(u32 i = 0; i < rowBytes; i++)
+            {
+                out[i] = raw[i] + prior[i];
+            }
+        } break;
+        case 3:
+        {
+            for(u32 i = 0; i < bpp; i++)
+            {
+                out[i] = raw[i] + (prior[i] >> 1);
+            }
+            for(u32 i = bpp; i < rowBytes; i++)
+            {
+                out[i] = raw[i] + (byte)(((u32)out[i - bpp] + (u32)prior[i]) >> 1);
+            }
+        } break;
+        case 4:
+        {
+            for(u32 i = 0; i < bpp; i++)
+            {
+                out[i] = raw[i] + prior[i];
+            }
+            for(u32 i = bpp; i < rowBytes; i++)
+            {
+                out[i] = raw[i] + paethPredictor(out[i - bpp], prior[i], prior[i - bpp]);
+            }
+        } break;
+        default:
+        {
+            result = false;
+        } break;
+    }
+    
+    return result;
+}
+
+// NOTE: Inflates into scratch and unfilters every scanline straight into dest, there is no decoded copy of the image.
+// Returns false when the image needs the general stb_image path, dest is untouched in that case.
+static bool decodePNGIntoRows(const byte* data, u32 size, u32 expectedWidth, u32 expectedHeight, u32 expectedChannels, byte* dest, u32 destPitch, MemoryStack* scratchArena)
+{
+    PNGImageInfo info;
+    if(!parsePNGChunks(data, size, &info))
+    {
+        return false;
+    }
+    if((info.width != expectedWidth) || (info.height != expectedHeight) || (info.channels != expectedChannels))
+    {
+        return false;
+    }
+    if((info.bitDepth != 8) || (info.interlaceMethod != 0) || info.hasTransparencyChunk)
+    {
+        return false;
+    }
+    
+    TemporaryMemory decodeMemory = BeginTemporaryMemory(scratchArena);
+    
+    u32 bpp = info.channels;
+    u32 rowBytes = info.width*bpp;
+    size_t filteredSize = (size_t)info.height*(rowBytes + 1);
+    const byte* compressed = gatherPNGImageData(data, size, &info, scratchArena);
+    if(!compressed)
+    {
+        EndTemporaryMemory(decodeMemory);
+        return false;
+    }
+    byte* filtered = PushSize(scratchArena, filteredSize, byte);
+    
+    bool result = false;
+    s32 inflatedSize = stbi_zlib_decode_buffer((char *)filtered, (s32)filteredSize, (const char *)compressed, (s32)info.imageDataSize);
+    if(inflatedSize == (s32)filteredSize)
+    {
+        // The first row has an implicit all zero row above it.
+        byte* zeroRow = PushSize(scratchArena, rowBytes, byte);
+        memset(zeroRow, 0, rowBytes);
+        
+        result = true;
+        const byte* prior = zeroRow;
+        const byte* source = filtered;
+        byte* row = dest;
+        for(u32 y = 0; (y < info.height) && result; y++)
+        {
+            result = unfilterPNGRow(source[0], source + 1, row, prior, rowBytes, bpp);
+            prior = row;
+            row += destPitch;
+            source += rowBytes + 1;
+        }
+    }
+    
+    EndTemporaryMemory(decodeMemory);
+    
+    return result;
+}
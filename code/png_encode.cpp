@@ -0,0 +1,131 @@
+//
+// 16 bit png encoding
+//
+
+// NOTE: stb_image_write only writes 8 bit channels. The deflate still comes from it,
+// the image data is laid out here: filter type none on every row and big endian samples.
+
+static u32 updatePNGCrc(u32 crc, const byte* data, u32 size)
+{
+    // Batch groups are written from several threads, a racing thread fills in the same values.
+    static u32 crcTable[256];
+    static u32 volatile crcTableReady;
+    if(!crcTableReady)
+    {
+        for(u32 n = 0; n < 256; n++)
+        {
+            u32 c = n;
+            for(u32 k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+            }
+            crcTable[n] = c;
+        }
+        _ReadWriteBarrier();
+        crcTableReady = 1;
+    }
+    
+    for(u32 i = 0; i < size; i++)
+    {
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    
+    return crc;
+}
+
+static void writePNGChunk(FILE* file, const char* type, const byte* data, u32 size)
+{
+    byte header[8];
+    header[0] = (byte)(size >> 24);
+    header[1] = (byte)(size >> 16);
+    header[2] = (byte)(size >> 8);
+    header[3] = (byte)size;
+    memcpy(header + 4, type, 4);
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, size, file);
+    
+    // The crc covers the chunk type and the data.
+    u32 crc = updatePNGCrc(0xffffffff, (const byte *)type, 4);
+    crc = updatePNGCrc(crc, data, size) ^ 0xffffffff;
+    
+    byte footer[4] = {(byte)(crc >> 24), (byte)(crc >> 16), (byte)(crc >> 8), (byte)crc};
+    fwrite(footer, 1, 4, file);
+}
+
+static bool writePNG16(const char* path, u32 width, u32 height, u32 channels, const byte* pixels, u32 pitch)
+{
+    static const byte signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    byte colorType = 0;
+    switch(channels)
+    {
+        case 1: colorType = PNG_COLOR_GRAY; break;
+        case 2: colorType = PNG_COLOR_GRAY_ALPHA; break;
+        case 3: colorType = PNG_COLOR_RGB; break;
+        case 4: colorType = PNG_COLOR_RGBA; break;
+        default: return false;
+    }
+    
+    u32 rowBytes = width*channels*2;
+    size_t filteredSize = (size_t)height*(rowBytes + 1);
+    byte* filtered = (byte *)VirtualAlloc(0, filteredSize, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+    CountAllocation();
+    // NOTE: PNG samples are big endian, the shuffle swaps the bytes of 8 samples at a time.
+    __m128i swapBytes = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    u32 sampleCount = width*channels;
+    byte* dest = filtered;
+    for(u32 y = 0; y < height; y++)
+    {
+        const u16* row = (const u16 *)(pixels + y*pitch);
+        *dest++ = 0;
+        u32 i = 0;
+        for(; i + 8 <= sampleCount; i += 8)
+        {
+            __m128i samples = _mm_loadu_si128((__m128i *)(row + i));
+            _mm_storeu_si128((__m128i *)dest, _mm_shuffle_epi8(samples, swapBytes));
+            dest += 16;
+        }
+        for(; i < sampleCount; i++)
+        {
+            *dest++ = (byte)(row[i] >> 8);
+            *dest++ = (byte)row[i];
+        }
+    }
+    
+    s32 compressedSize = 0;
+    byte* compressed = stbi_zlib_compress(filtered, (int)filteredSize, &compressedSize, stbi_write_png_compression_level);
+    VirtualFree(filtered, 0, MEM_RELEASE);
+    if(!compressed)
+    {
+        return false;
+    }
+    
+    bool result = false;
+    FILE* file = fopen(path, "wb");
+    if(file)
+    {
+        byte header[13];
+        header[0] = (byte)(width >> 24);
+        header[1] = (byte)(width >> 16);
+        header[2] = (byte)(width >> 8);
+        header[3] = (byte)width;
+        header[4] = (byte)(height >> 24);
+        header[5] = (byte)(height >> 16);
+        header[6] = (byte)(height >> 8);
+        header[7] = (byte)height;
+        header[8] = 16;
+        header[9] = colorType;
+        header[10] = 0;
+        header[11] = 0;
+        header[12] = 0;
+        
+        fwrite(signature, 1, 8, file);
+        writePNGChunk(file, "IHDR", header, sizeof(header));
+        writePNGChunk(file, "IDAT", compressed, (u32)compressedSize);
+        writePNGChunk(file, "IEND", nullptr, 0);
+        result = (ferror(file) == 0);
+        fclose(file);
+    }
+    STBIW_FREE(compressed);
+    
+    return result;
+}
@@ -0,0 +1,154 @@
+//
+// premultiplied alpha
+//
+
+// NOTE: The color channels are multiplied by the alpha in place, right after a sprite is decoded.
+// The plain mode multiplies the stored values. The srgb mode decodes them to linear light first and
+// encodes the product back, the way the gpu filters an srgb atlas. The 8 bit formats go through one
+// table of every alpha and color pair, built before any worker runs. Opaque pixels are left alone.
+
+struct PremultiplyTable
+{
+    bool isSRGB;
+    u8 values[256][256];    // NOTE: indexed by alpha, then color
+};
+
+static PremultiplyTable globalPremultiplyTable;
+
+static r32 convertSRGBToLinear(r32 value)
+{
+    return (value <= 0.04045f) ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+static r32 convertLinearToSRGB(r32 value)
+{
+    return (value <= 0.0031308f) ? value*12.92f : 1.055f*powf(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// NOTE: color and alpha are in [0, 1].
+static r32 premultiplyChannel(r32 color, r32 alpha, bool isSRGB)
+{
+    r32 result = color*alpha;
+    if(isSRGB)
+    {
+        result = convertLinearToSRGB(convertSRGBToLinear(color)*alpha);
+    }
+    
+    return result;
+}
+
+static void initPremultiplyTable(PremultiplyTable* table, bool isSRGB)
+{
+    table->isSRGB = isSRGB;
+    for(u32 alpha = 0; alpha < 256; alpha++)
+    {
+        for(u32 color = 0; color < 256; color++)
+        {
+            r32 value = premultiplyChannel((r32)color / 255.0f, (r32)alpha / 255.0f, isSRGB);
+            table->values[alpha][color] = (u8)(value*255.0f + 0.5f);
+        }
+    }
+}
+
+static bool canPremultiplyFormat(AtlasFormat format)
+{
+    return getAtlasFormatInfo(format)->channels == 4;
+}
+
+// NOTE: Four 8 bit channels with the alpha last, rgba or bgra.
+static void premultiplyPixels8(byte* pixels, u32 pixelCount, const PremultiplyTable* table)
+{
+    __m128i alphaMask = _mm_set1_epi32((s32)0xff000000);
+    __m128i zero = _mm_setzero_si128();
+    __m128i half = _mm_set1_epi16(128);
+    u32 i = 0;
+    for(; i + 4 <= pixelCount; i += 4)
+    {
+        byte* step = pixels + i*4;
+        __m128i source = _mm_loadu_si128((__m128i *)step);
+        __m128i alpha = _mm_and_si128(source, alphaMask);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xffff)
+        {
+            continue;
+        }
+        
+        if(table->isSRGB)
+        {
+            for(u32 j = 0; j < 4; j++)
+            {
+                byte* pixel = step + j*4;
+                const u8* values = table->values[pixel[3]];
+                pixel[0] = values[pixel[0]];
+                pixel[1] = values[pixel[1]];
+                pixel[2] = values[pixel[2]];
+            }
+            continue;
+        }
+        
+        // Every channel times the alpha of its pixel, divided by 255 with rounding as (x + 128)*257 >> 16.
+        __m128i low = _mm_unpacklo_epi8(source, zero);
+        __m128i high = _mm_unpackhi_epi8(source, zero);
+        __m128i lowAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(low, 0xff), 0xff);
+        __m128i highAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(high, 0xff), 0xff);
+        low = _mm_add_epi16(_mm_mullo_epi16(low, lowAlpha), half);
+        high = _mm_add_epi16(_mm_mullo_epi16(high, highAlpha), half);
+        low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+        high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+        __m128i result = _mm_packus_epi16(low, high);
+        result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), alpha);
+        _mm_storeu_si128((__m128i *)step, result);
+    }
+    
+    for(; i < pixelCount; i++)
+    {
+        byte* pixel = pixels + i*4;
+        const u8* values = table->values[pixel[3]];
+        pixel[0] = values[pixel[0]];
+        pixel[1] = values[pixel[1]];
+        pixel[2] = values[pixel[2]];
+    }
+}
+
+// NOTE: Four 16 bit channels with the alpha last, a table would be too big so the channels are computed.
+static void premultiplyPixels16(u16* pixels, u32 pixelCount, bool isSRGB)
+{
+    for(u32 i = 0; i < pixelCount; i++)
+    {
+        u16* pixel = pixels + i*4;
+        u32 alpha = pixel[3];
+        if(alpha == 0xffff)
+        {
+            continue;
+        }
+        for(u32 channel = 0; channel < 3; channel++)
+        {
+            if(isSRGB)
+            {
+                r32 value = premultiplyChannel((r32)pixel[channel] / 65535.0f, (r32)alpha / 65535.0f, true);
+                pixel[channel] = (u16)(value*65535.0f + 0.5f);
+            }
+            else
+            {
+                pixel[channel] = (u16)(((u32)pixel[channel]*alpha + 32767) / 65535);
+            }
+        }
+    }
+}
+
+// NOTE: Rows are pitch bytes apart, the format has to have four channels.
+static void premultiplyPixelRows(byte* pixels, u32 width, u32 height, u32 pitch, AtlasFormat format, const PremultiplyTable* table)
+{
+    bool is16Bit = isAtlasFormat16Bit(format);
+    for(u32 y = 0; y < height; y++)
+    {
+        if(is16Bit)
+        {
+            premultiplyPixels16((u16 *)pixels, width, table->isSRGB);
+        }
+        else
+        {
+            premultiplyPixels8(pixels, width, table);
+        }
+        pixels += pitch;
+    }
+}
@@ -0,0 +1,58 @@
+//
+// radix sort
+//
+
+// NOTE: LSD radix sort of 64 bit keys, one byte per pass. Equal keys keep their order, so with a
+// record index in the low bits every key is distinct and the result only depends on the input.
+// Passes where every key has the same byte are skipped, small keys only pay for the bytes they use.
+
+#define RADIX_SORT_BUCKETS 256
+
+// NOTE: Sorts keys ascending, temp holds count keys. The result ends up in keys.
+static void radixSort64(u64* keys, u64* temp, u32 count)
+{
+    // One counting pass builds the histograms of all eight bytes at once.
+    u32 histograms[8][RADIX_SORT_BUCKETS] = {};
+    for(u32 i = 0; i < count; i++)
+    {
+        u64 key = keys[i];
+        for(u32 pass = 0; pass < 8; pass++)
+        {
+            histograms[pass][(key >> (pass*8)) & 0xff]++;
+        }
+    }
+    
+    u64* source = keys;
+    u64* dest = temp;
+    for(u32 pass = 0; pass < 8; pass++)
+    {
+        u32* histogram = histograms[pass];
+        u32 shift = pass*8;
+        if(count && (histogram[(source[0] >> shift) & 0xff] == count))
+        {
+            continue;
+        }
+        
+        u32 offset = 0;
+        for(u32 bucket = 0; bucket < RADIX_SORT_BUCKETS; bucket++)
+        {
+            u32 bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+        for(u32 i = 0; i < count; i++)
+        {
+            u64 key = source[i];
+            dest[histogram[(key >> shift) & 0xff]++] = key;
+        }
+        
+        u64* swap = source;
+        source = dest;
+        dest = swap;
+    }
+    
+    if(source != keys)
+    {
+        memcpy(keys, source, count*sizeof(u64));
+    }
+}
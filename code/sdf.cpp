@@ -0,0 +1,172 @@
+//
+// signed distance fields
+//
+
+// NOTE: Exact euclidean distance transform, Felzenszwalb and Huttenlocher, done separably:
+// one pass down every column, then one along every row. The field is computed on the sprite padded by
+// spread on each side, box filtered by downscale and stored as 0.5 at the edge, larger inside.
+
+#define SDF_INFINITY 1e20f
+// NOTE: Bounds of the options, so the padded sprite and its distance buffers stay well inside u32 sizes.
+#define MAX_SDF_SPREAD 128
+#define MAX_SDF_DOWNSCALE 16
+#define SDF_INSIDE_THRESHOLD 128
+
+struct SignedDistanceFieldSize
+{
+    u32 paddedWidth;    // NOTE: in source pixels, a multiple of downscale
+    u32 paddedHeight;
+    u32 width;
+    u32 height;
+};
+
+static SignedDistanceFieldSize getSignedDistanceFieldSize(u32 width, u32 height, u32 spread, u32 downscale)
+{
+    SignedDistanceFieldSize result;
+    result.paddedWidth = width + 2*spread;
+    result.paddedHeight = height + 2*spread;
+    result.paddedWidth += (downscale - result.paddedWidth % downscale) % downscale;
+    result.paddedHeight += (downscale - result.paddedHeight % downscale) % downscale;
+    result.width = result.paddedWidth / downscale;
+    result.height = result.paddedHeight / downscale;
+    
+    return result;
+}
+
+// NOTE: 1D squared distance transform of f, count samples stride floats apart, in place.
+// d, v and z are scratch for count, count and count + 1 elements.
+static void distanceTransform1D(r32* f, u32 count, u32 stride, r32* d, s32* v, r32* z)
+{
+    // Lower envelope of the parabolas rooted at every sample.
+    s32 k = 0;
+    v[0] = 0;
+    z[0] = -SDF_INFINITY;
+    z[1] = SDF_INFINITY;
+    for(s32 q = 1; q < (s32)count; q++)
+    {
+        r32 fq = f[q*stride];
+        r32 s;
+        for(;;)
+        {
+            // f is subtracted first so two infinite samples still intersect halfway between.
+            s32 p = v[k];
+            s = ((fq - f[p*stride]) + (r32)(q*q - p*p)) / (r32)(2*q - 2*p);
+            if(s > z[k])
+            {
+                break;
+            }
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = SDF_INFINITY;
+    }
+    
+    k = 0;
+    for(s32 q = 0; q < (s32)count; q++)
+    {
+        while(z[k + 1] < (r32)q)
+        {
+            k++;
+        }
+        s32 p = v[k];
+        r32 delta = (r32)(q - p);
+        d[q] = delta*delta + f[p*stride];
+    }
+    for(u32 q = 0; q < count; q++)
+    {
+        f[q*stride] = d[q];
+    }
+}
+
+static void distanceTransform2D(r32* grid, u32 width, u32 height, MemoryStack* scratchArena)
+{
+    TemporaryMemory transformMemory = BeginTemporaryMemory(scratchArena);
+    u32 maxCount = max(width, height);
+    r32* d = PushArray(scratchArena, maxCount, r32);
+    s32* v = PushArray(scratchArena, maxCount, s32);
+    r32* z = PushArray(scratchArena, maxCount + 1, r32);
+    
+    for(u32 x = 0; x < width; x++)
+    {
+        distanceTransform1D(grid + x, height, width, d, v, z);
+    }
+    for(u32 y = 0; y < height; y++)
+    {
+        distanceTransform1D(grid + y*width, width, 1, d, v, z);
+    }
+    
+    EndTemporaryMemory(transformMemory);
+}
+
+// NOTE: coverage is one byte per pixel, tightly packed. dest gets size.width*size.height bytes.
+static void computeSignedDistanceField(const byte* coverage, u32 width, u32 height, u32 spread, u32 downscale, byte* dest, MemoryStack* scratchArena)
+{
+    TemporaryMemory fieldMemory = BeginTemporaryMemory(scratchArena);
+    SignedDistanceFieldSize size = getSignedDistanceFieldSize(width, height, spread, downscale);
+    u32 paddedCount = size.paddedWidth*size.paddedHeight;
+    
+    // Squared distances to the nearest inside pixel and to the nearest outside pixel.
+    r32* toInside = PushArrayAligned(scratchArena, paddedCount, r32, 16);
+    r32* toOutside = PushArrayAligned(scratchArena, paddedCount, r32, 16);
+    for(u32 y = 0; y < size.paddedHeight; y++)
+    {
+        for(u32 x = 0; x < size.paddedWidth; x++)
+        {
+            // The padding wraps around to large values and lands outside.
+            u32 sourceX = x - spread;
+            u32 sourceY = y - spread;
+            bool isInside = (sourceX < width) && (sourceY < height) && (coverage[sourceY*width + sourceX] >= SDF_INSIDE_THRESHOLD);
+            toInside[y*size.paddedWidth + x] = isInside ? 0.0f : SDF_INFINITY;
+            toOutside[y*size.paddedWidth + x] = isInside ? SDF_INFINITY : 0.0f;
+        }
+    }
+    distanceTransform2D(toInside, size.paddedWidth, size.paddedHeight, scratchArena);
+    distanceTransform2D(toOutside, size.paddedWidth, size.paddedHeight, scratchArena);
+    
+    // Signed distance to the edge, half a pixel off the centers, positive outside.
+    // Exactly one of the two is zero for every pixel, so the difference of the roots gives the sign.
+    r32* distance = toInside;
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 zero = _mm_setzero_ps();
+    u32 i = 0;
+    for(; i + 4 <= paddedCount; i += 4)
+    {
+        __m128 inside = _mm_sqrt_ps(_mm_load_ps(toInside + i));
+        __m128 outside = _mm_sqrt_ps(_mm_load_ps(toOutside + i));
+        __m128 isOutside = _mm_cmpgt_ps(inside, zero);
+        __m128 edge = _mm_or_ps(_mm_and_ps(isOutside, half), _mm_andnot_ps(isOutside, _mm_sub_ps(zero, half)));
+        _mm_store_ps(distance + i, _mm_sub_ps(_mm_sub_ps(inside, outside), edge));
+    }
+    for(; i < paddedCount; i++)
+    {
+        r32 inside = sqrtf(toInside[i]);
+        r32 outside = sqrtf(toOutside[i]);
+        distance[i] = (inside > 0.0f) ? inside - 0.5f : -(outside - 0.5f);
+    }
+    
+    // Box filter down, then map [-spread, spread] to [255, 0].
+    r32 scale = 1.0f / (r32)(downscale*downscale);
+    r32 toByte = -127.5f / (r32)spread;
+    for(u32 y = 0; y < size.height; y++)
+    {
+        for(u32 x = 0; x < size.width; x++)
+        {
+            r32 sum = 0.0f;
+            for(u32 j = 0; j < downscale; j++)
+            {
+                const r32* row = distance + (y*downscale + j)*size.paddedWidth + x*downscale;
+                for(u32 k = 0; k < downscale; k++)
+                {
+                    sum += row[k];
+                }
+            }
+            r32 value = 127.5f + sum*scale*toByte;
+            value = (value < 0.0f) ? 0.0f : ((value > 255.0f) ? 255.0f : value);
+            dest[y*size.width + x] = (byte)(value + 0.5f);
+        }
+    }
+    
+    EndTemporaryMemory(fieldMemory);
+}
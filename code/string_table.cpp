@@ -0,0 +1,136 @@
+//
+// interned string table
+//
+
+// NOTE: Every distinct string is stored once, null terminated and packed back to back.
+// Strings are referred to by their u32 offset into the string arena.
+
+#define STRING_TABLE_EMPTY_SLOT 0xffffffff
+
+struct StringTable
+{
+    MemoryStack stringArena;
+    MemoryStack slotArena;
+    u32* slots;         // NOTE: offsets into the string arena, linear probing
+    u32 slotCapacity;   // NOTE: always a power of two
+    u32 stringCount;
+};
+
+static u32 hashString(const char* string)
+{
+    // FNV-1a
+    u32 result = 2166136261u;
+    for(; *string; string++)
+    {
+        result ^= (u8)*string;
+        result *= 16777619u;
+    }
+    
+    return result;
+}
+
+static const char* getString(StringTable* table, u32 offset)
+{
+    const char* result = (const char *)table->stringArena.base + offset;
+    return result;
+}
+
+static void allocateStringTableSlots(StringTable* table, u32 capacity)
+{
+    table->slots = PushArray(&table->slotArena, capacity, u32);
+    table->slotCapacity = capacity;
+    memset(table->slots, 0xff, capacity*sizeof(u32));
+}
+
+static StringTable makeStringTable(u32 expectedCount)
+{
+    StringTable result = {};
+    result.stringArena = InitGrowableStackMemory();
+    result.slotArena = InitGrowableStackMemory();
+    
+    u32 capacity = 64;
+    while(capacity < expectedCount*2)
+    {
+        capacity <<= 1;
+    }
+    allocateStringTableSlots(&result, capacity);
+    
+    return result;
+}
+
+static void destroyStringTable(StringTable* table)
+{
+    FreeMemoryStack(&table->stringArena);
+    FreeMemoryStack(&table->slotArena);
+    table->slots = nullptr;
+    table->slotCapacity = 0;
+    table->stringCount = 0;
+}
+
+static void growStringTable(StringTable* table)
+{
+    u32* oldSlots = table->slots;
+    u32 oldCapacity = table->slotCapacity;
+    
+    // The old slots stay behind in the slot arena, growth is geometric so that is at most half of it.
+    allocateStringTableSlots(table, oldCapacity*2);
+    u32 mask = table->slotCapacity - 1;
+    for(u32 i = 0; i < oldCapacity; i++)
+    {
+        u32 offset = oldSlots[i];
+        if(offset != STRING_TABLE_EMPTY_SLOT)
+        {
+            u32 index = hashString(getString(table, offset)) & mask;
+            while(table->slots[index] != STRING_TABLE_EMPTY_SLOT)
+            {
+                index = (index + 1) & mask;
+            }
+            table->slots[index] = offset;
+        }
+    }
+}
+
+static u32 internString(StringTable* table, const char* string)
+{
+    if((table->stringCount + 1)*2 > table->slotCapacity)
+    {
+        growStringTable(table);
+    }
+    
+    u32 mask = table->slotCapacity - 1;
+    u32 index = hashString(string) & mask;
+    for(;;)
+    {
+        u32 offset = table->slots[index];
+        if(offset == STRING_TABLE_EMPTY_SLOT)
+        {
+            break;
+        }
+        if(strcmp(getString(table, offset), string) == 0)
+        {
+            return offset;
+        }
+        index = (index + 1) & mask;
+    }
+    
+    u32 length = (u32)strlen(string);
+    char* dest = PushArray(&table->stringArena, length + 1, char);
+    memcpy(dest, string, length + 1);
+    
+    u32 result = (u32)(dest - (char *)table->stringArena.base);
+    table->slots[index] = result;
+    table->stringCount++;
+    
+    return result;
+}
+
+static u32 getSharedPrefixLength(const char* a, const char* b)
+{
+    u32 result = 0;
+    while(a[result] && (a[result] == b[result]))
+    {
+        result++;
+    }
+    
+    return result;
+}
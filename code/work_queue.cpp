@@ -0,0 +1,143 @@
+//
+// multi threaded work queue
+//
+
+struct WorkQueue;
+
+#define WORK_QUEUE_CALLBACK(name) void name(WorkQueue* queue, void* data, u32 threadIndex)
+typedef WORK_QUEUE_CALLBACK(WorkQueueCallback);
+
+#define MAX_WORK_QUEUE_ENTRIES 256
+#define MAX_WORKER_THREADS 64
+
+struct WorkQueueEntry
+{
+    WorkQueueCallback* callback;
+    void* data;
+};
+
+struct WorkerThreadInfo
+{
+    WorkQueue* queue;
+    u32 threadIndex;
+};
+
+struct WorkQueue
+{
+    u32 volatile completionGoal;
+    u32 volatile completionCount;
+    u32 volatile nextEntryToWrite;
+    u32 volatile nextEntryToRead;
+    HANDLE semaphoreHandle;
+    
+    // NOTE: thread index 0 is the main thread, workers are 1..threadCount-1
+    u32 threadCount;
+    WorkerThreadInfo threadInfos[MAX_WORKER_THREADS];
+    WorkQueueEntry entries[MAX_WORK_QUEUE_ENTRIES];
+};
+
+static u32 getProcessorCount()
+{
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    
+    return (u32)systemInfo.dwNumberOfProcessors;
+}
+
+static bool doNextWorkQueueEntry(WorkQueue* queue, u32 threadIndex)
+{
+    bool shouldSleep = false;
+    
+    u32 originalNextEntryToRead = queue->nextEntryToRead;
+    u32 newNextEntryToRead = (originalNextEntryToRead + 1) % MAX_WORK_QUEUE_ENTRIES;
+    if(originalNextEntryToRead != queue->nextEntryToWrite)
+    {
+        u32 index = InterlockedCompareExchange((LONG volatile *)&queue->nextEntryToRead, newNextEntryToRead, originalNextEntryToRead);
+        if(index == originalNextEntryToRead)
+        {
+            WorkQueueEntry entry = queue->entries[index];
+            entry.callback(queue, entry.data, threadIndex);
+            InterlockedIncrement((LONG volatile *)&queue->completionCount);
+        }
+    }
+    else
+    {
+        shouldSleep = true;
+    }
+    
+    return shouldSleep;
+}
+
+// NOTE: single producer, only the main thread adds entries.
+static void addWorkQueueEntry(WorkQueue* queue, WorkQueueCallback* callback, void* data)
+{
+    u32 newNextEntryToWrite = (queue->nextEntryToWrite + 1) % MAX_WORK_QUEUE_ENTRIES;
+    // The ring is full, help out until a slot frees up.
+    while(newNextEntryToWrite == queue->nextEntryToRead)
+    {
+        doNextWorkQueueEntry(queue, 0);
+    }
+    WorkQueueEntry* entry = queue->entries + queue->nextEntryToWrite;
+    entry->callback = callback;
+    entry->data = data;
+    queue->completionGoal++;
+    _ReadWriteBarrier();
+    queue->nextEntryToWrite = newNextEntryToWrite;
+    ReleaseSemaphore(queue->semaphoreHandle, 1, 0);
+}
+
+static void completeAllWork(WorkQueue* queue)
+{
+    while(queue->completionGoal != queue->completionCount)
+    {
+        doNextWorkQueueEntry(queue, 0);
+    }
+    
+    queue->completionGoal = 0;
+    queue->completionCount = 0;
+}
+
+static DWORD WINAPI workerThreadProc(LPVOID parameter)
+{
+    WorkerThreadInfo* info = (WorkerThreadInfo *)parameter;
+    WorkQueue* queue = info->queue;
+    
+    for(;;)
+    {
+        if(doNextWorkQueueEntry(queue, info->threadIndex))
+        {
+            WaitForSingleObjectEx(queue->semaphoreHandle, INFINITE, FALSE);
+        }
+    }
+}
+
+static void makeWorkQueue(WorkQueue* queue, u32 threadCount)
+{
+    if(threadCount == 0)
+    {
+        threadCount = getProcessorCount();
+    }
+    threadCount = min(threadCount, (u32)MAX_WORKER_THREADS);
+    
+    queue->completionGoal = 0;
+    queue->completionCount = 0;
+    queue->nextEntryToWrite = 0;
+    queue->nextEntryToRead = 0;
+    queue->threadCount = threadCount;
+    
+    u32 initialCount = 0;
+    queue->semaphoreHandle = CreateSemaphoreExA(0, initialCount, threadCount, 0, 0, SEMAPHORE_ALL_ACCESS);
+    
+    queue->threadInfos[0].queue = queue;
+    queue->threadInfos[0].threadIndex = 0;
+    for(u32 threadIndex = 1; threadIndex < threadCount; threadIndex++)
+    {
+        WorkerThreadInfo* info = queue->threadInfos + threadIndex;
+        info->queue = queue;
+        info->threadIndex = threadIndex;
+        
+        DWORD threadID;
+        HANDLE threadHandle = CreateThread(0, 0, workerThreadProc, info, 0, &threadID);
+        CloseHandle(threadHandle);
+    }
+}